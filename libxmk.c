@@ -0,0 +1,5538 @@
+/*
+* libxmk, xmk build engine as a library
+*
+* 2019 - 2020 Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public LIcense as publised by
+* the Free Software Foundation; either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+* MA 02110-1301, USA.
+*/
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <windows.h>
+#elif defined(__unix__)
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#endif
+#include <setjmp.h>
+#include "xmk.h"
+
+/* SystemTap-compatible USDT probes. They compile into a single
+ * nop instruction, so they cost nothing unless a tracer such as
+ * perf or bpftrace is attached. Define XMK_NO_USDT to remove them.
+ * Available probes: token, define_expanded, target_resolved,
+ * job_queued, job_spawned, job_reaped and cache_lookup. */
+#if !defined(XMK_NO_USDT) && defined(__has_include)
+#	if __has_include(<sys/sdt.h>)
+#		include <sys/sdt.h>
+#		define XMK_USDT
+#	endif
+#endif
+
+#ifdef XMK_USDT
+#	define PROBE1(name, a) DTRACE_PROBE1(xmk, name, a)
+#	define PROBE2(name, a, b) DTRACE_PROBE2(xmk, name, a, b)
+#	define PROBE3(name, a, b, c) DTRACE_PROBE3(xmk, name, a, b, c)
+#else
+#	define PROBE1(name, a) ((void)0)
+#	define PROBE2(name, a, b) ((void)0)
+#	define PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#define BUILD_LOG_FILE_NAME ".xmk_log"
+#define FINGERPRINT_FILE_NAME ".xmk_fingerprint"
+#define DIR_CACHE_FILE_NAME ".xmk_dirs"
+#define GRAPH_FILE_NAME ".xmk_graph"
+#define STATUS_REFRESH_MS 200
+#define MINHASH_SIZE 16
+#define MAX_RECURSION 2
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+#if defined(typeof) && (__STDC_VERSION__ >= 201112L)
+/* Provide a safer version which refuses to compile when
+ * pointers (instead of arrays) are passed to this macro. */
+#	define LENGTHOF(a) \
+    _Generic (	&a, \
+                typeof (*a) **: (void)0, \
+                typeof (*a) *const *: (void)0, \
+                default: ARRAY_SIZE_DEFALT(a))
+#else
+#	define LENGTHOF(a) (sizeof (a) / sizeof (a[0]))
+#endif
+
+#ifdef XMK_NO_LOG
+/* Logging is compiled out, so arguments are never evaluated. */
+#	define LOGV(...) ((void)0)
+#	define LOGVV(...) ((void)0)
+#else
+/* Arguments are only evaluated if logging is enabled. */
+#	define LOGV(...) (verbose() ? logv(__func__, __LINE__, __VA_ARGS__) : (void)0)
+#	define LOGVV(...) (extra_verbose() ? logvv(__func__, __LINE__, __VA_ARGS__) : (void)0)
+#endif
+#define FATAL_ERROR(...) fatal_error(__func__, __LINE__, __VA_ARGS__)
+
+#define foreach(type, iter, list) \
+    for (struct {type *i; char brk;} __a = \
+        {.i = list, .brk = 0}; \
+        (size_t)(__a.i - list) < LENGTHOF(list) && !__a.brk; \
+        __a.i++, __a.brk--) \
+        for (type *const iter = __a.i; \
+            !__a.brk; \
+            __a.brk++)
+
+#if __STDC_VERSION__ >= 201112L
+#	define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#	define THREAD_LOCAL __thread
+#else
+#	define THREAD_LOCAL
+#endif
+
+static struct xmk_options config;
+
+/* Fatal errors jump back to the library function that was
+ * called, so they are reported to the caller instead of
+ * terminating the process. */
+static THREAD_LOCAL jmp_buf *error_handler;
+static THREAD_LOCAL char error_message[512];
+
+enum parse_state
+{
+    SEARCHING,
+    CHECKING
+};
+
+enum rule
+{
+    DEFINE_AS,
+    BUILD,
+    DEPENDS_ON,
+    CREATED_USING,
+    TARGET,
+
+    MAX_RULES
+};
+
+/* Functions on paths, called as $(NAME ARGUMENTS), see eval_function(). */
+enum path_function
+{
+    /* Path without the extension of its file name. */
+    PATH_BASENAME,
+    /* Extension of the file name, without the dot. */
+    PATH_EXT,
+    /* Directory part, including its last slash, or "./". */
+    PATH_DIR,
+    /* File name, without any directories. */
+    PATH_NOTDIR,
+    /* $(patsubst PATTERN,REPLACEMENT,TEXT), where a "%" in PATTERN
+     * matches any stem, which replaces the "%" in REPLACEMENT. TEXT
+     * is returned unchanged if it does not match PATTERN. */
+    PATH_PATSUBST
+};
+
+static const struct
+{
+    const char *name;
+    /* Arguments are separated by commas. */
+    size_t n_args;
+} path_functions[] =
+{
+    [PATH_BASENAME] = {.name = "basename", .n_args = 1},
+    [PATH_EXT] = {.name = "ext", .n_args = 1},
+    [PATH_DIR] = {.name = "dir", .n_args = 1},
+    [PATH_NOTDIR] = {.name = "notdir", .n_args = 1},
+    [PATH_PATSUBST] = {.name = "patsubst", .n_args = 3}
+};
+
+struct parser;
+
+typedef struct
+{
+    const char *const* const keywords;
+    const enum recipe
+    {
+        KEYWORD,
+        SYMBOL,
+        LIST,
+        NESTED_RULE,
+        END
+    } *const *const recipe_list;
+
+    const enum rule *const nested_rules;
+    void (*const symbol_callback)(struct parser *, const char *);
+    enum parse_state (*const scope_block_opened)(struct parser *);
+    const char *const scope_block_opened_str;
+} syntax_rule;
+
+/* Per-target traversal state, shared by all roots. */
+static struct
+{
+    enum
+    {
+        VISIT_PENDING,
+        VISIT_IN_PROGRESS,
+        VISIT_DONE
+    } *state;
+    /* Whether the target was built, so parents must be built too. */
+    bool *updated;
+} visited;
+
+/* Open addressing hash table storing indexes into an external
+ * array of strings, so keys are never copied. */
+struct hash_table
+{
+    /* Index + 1 into the key array, or 0 if the slot is empty. */
+    size_t *slots;
+    size_t capacity;
+    size_t n;
+};
+
+/* Strings allocated from an arena are never freed one by one,
+ * but all at once when the arena itself is released. */
+struct arena
+{
+    struct arena_block
+    {
+        struct arena_block *next;
+        size_t used;
+        size_t size;
+        char data[];
+    } *head;
+    /* Last string allocated, which can still grow in place. */
+    char *last;
+    /* Number of strings allocated. */
+    size_t n;
+};
+
+/* Parser context. All parser state lives here instead of
+ * globals or function statics, so several manifests can
+ * be parsed at the same time, even from different threads. */
+struct parser
+{
+    char *file_buffer;
+    size_t line;
+    /* Name of the target whose block is being parsed. */
+    char *current_scope;
+
+    /* Symbols found for each rule, one list per target.
+     * Targets themselves are stored in *symbols[TARGET].list. */
+    struct symbol_list
+    {
+        char ***list;
+        size_t *list_size;
+    } symbols[MAX_RULES];
+
+    /* Default targets, from "build" statements. */
+    struct
+    {
+        char **names;
+        size_t n;
+    } build_targets;
+
+    /* Definitions store data pairs, so default
+     * symbol lists cannot be used here. */
+    struct
+    {
+        char **names;
+        char **values;
+        /* Values with references to other defines already
+         * replaced, or NULL if not computed yet. */
+        char **expanded;
+        size_t n;
+        size_t selected_i;
+        /* Defines from this index on were found inside the block of
+         * the target being parsed, and are only visible from it. */
+        size_t scope_start;
+    } defines;
+
+    enum
+    {
+        GET_NAME,
+        GET_VALUE
+    } define_state;
+
+    /* Target names, indexed by target index. */
+    struct hash_table target_table;
+
+    /* Owns every symbol, target and define string above. */
+    struct arena strings;
+
+    /* Paths are stored once, no matter how many targets depend
+     * on them. Commands and defines are not interned. Only
+     * needed while parsing, see load(). */
+    struct
+    {
+        char **names;
+        size_t n;
+        struct hash_table table;
+        /* Bytes used by names. Along with n, kept for
+         * print_memstats() once names and table are released. */
+        size_t bytes;
+    } paths;
+
+    /* Directory listings used to expand glob dependencies,
+     * also stored into DIR_CACHE_FILE_NAME between runs.
+     * Only needed while parsing, see load(). */
+    struct
+    {
+        char **paths;
+        long long *mtime_ns;
+        /* Sorted entries of each directory. */
+        char ***entries;
+        size_t *n_entries;
+        /* Whether the directory is up to date for this manifest. */
+        bool *used;
+        size_t n;
+        struct hash_table table;
+        struct arena strings;
+        /* Dependency list being expanded, see expand_globs(). */
+        char **expanded;
+        size_t checked;
+        bool loaded;
+        bool modified;
+    } dirs;
+
+    /* Directories matched against globs. Their contents are part of
+     * the fingerprint, so new files are noticed without parsing. */
+    struct
+    {
+        char **names;
+        size_t n;
+    } glob_dirs;
+
+    /* Memory used to read the input file, which does not grow
+     * as defines are expanded, and number of defines expanded. */
+    size_t buffer_peak;
+    size_t expansions;
+
+    /* Results from path functions, keyed by function and arguments,
+     * see eval_function(). Only needed while parsing, see load(). */
+    struct
+    {
+        char **keys;
+        const char **results;
+        size_t n;
+        struct hash_table table;
+    } calls;
+
+    /* Scratch buffer used by define_value(). */
+    struct
+    {
+        char *data;
+        size_t len;
+        size_t size;
+    } expansion;
+
+    /* Values of the defines being expanded, innermost last, which
+     * are read by get_word() in place of their references. The
+     * input file itself is on the bottom for preprocess(). */
+    struct
+    {
+        struct source
+        {
+            const char *text;
+            size_t pos;
+            /* Text up to here has already been written. */
+            size_t written;
+        } *list;
+        size_t n;
+        size_t size;
+    } sources;
+
+    /* Number of blocks opened, so the end of a target is known. */
+    size_t depth;
+
+    /* Recipe progress for each nesting level, see check_rule(). */
+    size_t step_i[MAX_RECURSION];
+    size_t keyword_i[MAX_RECURSION];
+    size_t recipe_i[MAX_RECURSION];
+    size_t recursion_level;
+
+    /* Returned by get_word(). */
+    char word[255];
+};
+
+/* Reverse dependency index. Nodes are targets, whose node
+ * indexes match target indexes, followed by plain files.
+ * Edges are stored in CSR form: node n depends on
+ * deps[dep_start[n]] ... deps[dep_start[n + 1] - 1] and is
+ * needed by rdeps[rdep_start[n]] ... rdeps[rdep_start[n + 1] - 1]. */
+struct graph
+{
+    const char **names;
+    size_t n;
+    size_t n_targets;
+    struct hash_table table;
+    size_t *dep_start;
+    size_t *deps;
+    size_t *rdep_start;
+    size_t *rdeps;
+};
+
+/* Library handle, see xmk.h. */
+struct xmk
+{
+    struct parser parser;
+    struct graph graph;
+    /* Input file path, recorded into the fingerprint. */
+    char *path;
+    /* Targets given by the user, see resolve_roots(). */
+    const char **roots;
+    unsigned long long parse_us;
+    /* Node names, when read from GRAPH_FILE_NAME instead of parsed. */
+    char *index_buffer;
+};
+
+/* Manifest being built. Unlike parsing, only
+ * one build can run at a time in a process. */
+static struct xmk *manifest;
+
+/* Scheduling priority. Targets that failed during the last run,
+ * or whose inputs were edited most recently, are built first so
+ * errors are reported as soon as possible. */
+static struct
+{
+    bool *computed;
+    /* Target or any of its dependencies failed during last run. */
+    bool *failed;
+    /* Newest modification time among all of its input files. */
+    long long *newest;
+    /* MinHash signatures of dependency sets, used by --locality. */
+    unsigned long long (*signature)[MINHASH_SIZE];
+    /* Signature of the last target whose commands were executed. */
+    const unsigned long long *last;
+} priority;
+
+/* Counters exported by --metrics-out. */
+static struct
+{
+    size_t jobs_spawned;
+    size_t stat_calls;
+    size_t up_to_date;
+    size_t built;
+    unsigned long long parse_us;
+    unsigned long long build_start_us;
+} metrics;
+
+/* Build order of the dependencies of each target being visited, one
+ * after another, so they are released by cleanup() if building fails.
+ * Targets refer to theirs by index, since nested ones can move them. */
+static struct
+{
+    size_t *deps;
+    size_t n;
+    size_t size;
+} orders;
+
+/* States of the input file and of every plain file, taken before
+ * running any command, see fingerprint_save(). */
+static struct
+{
+    long long (*states)[2];
+} fingerprint;
+
+/* Modification time and size of each graph node, so every file is
+ * only stat'ed once per build. Only the entry of a target whose
+ * commands have just run is read again, see file_state(). */
+static struct
+{
+    long long (*states)[2];
+    bool *known;
+} file_states;
+
+/* Notified when each job finishes, see xmk_build(). */
+static struct
+{
+    xmk_job_callback callback;
+    void *user;
+} job_done;
+
+static void fatal_error(const char *func, int line, const char *format, ...);
+static bool verbose(void);
+#ifndef XMK_NO_LOG
+static bool extra_verbose(void);
+#endif
+static void parser_init(struct parser *p);
+static void parser_free(struct parser *p);
+static int check_syntax(struct parser *p);
+static void preprocess(struct parser *p, FILE *out);
+static const char *get_word(struct parser *p, const char *buffer, size_t *from, bool *newline_detected);
+static const char *eval_function(struct parser *p, const char *word);
+static const char *path_function(struct parser *p, enum path_function f, const char *key, const size_t *args);
+static const char *get_dependency(struct parser *p, const char *word);
+static const char *eval_arg(struct parser *p, const char *arg);
+bool is_define(struct parser *p, const char *name);
+static bool find_define(const struct parser *p, const char *name, size_t *index);
+static const char *define_value(struct parser *p, size_t i);
+static bool check_rule(struct parser *p, const syntax_rule *rule, const char *word, enum parse_state *state, bool *newline_detected);
+static void add_symbol(struct parser *p, const syntax_rule *rule, const char *word);
+static void set_build_target(struct parser *p, const char *target);
+static void add_target(struct parser *p, const char *target);
+static void add_define(struct parser *p, const char *define);
+static void create_basic_tree(struct parser *p, struct symbol_list *dep_list);
+enum parse_state target_scope_block_opened(struct parser *p);
+enum parse_state depends_on_scope_block_opened(struct parser *p);
+static bool scope(struct parser *p, const syntax_rule *rule, const char *word, enum parse_state *state, bool *finished);
+static bool handle_list(struct parser *p,
+                        const syntax_rule* rule,
+                        const char *word,
+                        enum parse_state* state,
+                        bool newline_detected,
+                        bool* finished);
+enum parse_state created_using_scope_block_opened(struct parser *p);
+static int execute_commands(const char *target, bool *parent_update_pending);
+static int ex_build_target(const char *build_target, size_t target_idx, bool *parent_update_pending);
+static int simulate(const char *target, size_t target_idx);
+static void simulation_summary(void);
+static void build_log_load(void);
+static void build_log_save(void);
+static void print_stats(void);
+static void print_memstats(const struct xmk *m);
+static long peak_rss_kib(void);
+static void metrics_save(bool success);
+static bool fingerprint_matches(const char *input, const char *const *roots, size_t n);
+static void fingerprint_snapshot(const char *input);
+static void fingerprint_save(const char *input, const char *const *roots, size_t n);
+static void status_init(const char *const *targets, size_t n);
+static void status_refresh(void);
+static void status_clear(void);
+static void status_timer(bool enable);
+static void status_waiting(bool waiting);
+static void status_child(void);
+static void status_update(void);
+static void status_job_start(const char *target, size_t target_idx);
+static void status_job_end(size_t target_idx);
+static bool update_needed(const char *target, const char *dep);
+static long long file_mtime_ns(const char *file);
+static void file_states_init(void);
+static void file_state(const char *file, long long state[2]);
+static void file_state_changed(size_t node);
+static long long stat_mtime_ns(const char *file);
+static void priority_sort(size_t target_idx, size_t *order);
+static void prefetch_inputs(size_t target_idx);
+static bool file_exists(const char *file);
+static bool target_exists(const struct parser *p, const char *target, size_t *index);
+static bool hash_find(const struct hash_table *h, const char *const *keys, const char *key, size_t *index);
+static void hash_insert(struct hash_table *h, const char *const *keys, size_t index);
+static char *arena_alloc(struct arena *a, size_t sz);
+static char *arena_strdup(struct arena *a, const char *str);
+static char *arena_strndup(struct arena *a, const char *str, size_t len);
+static char *arena_append(struct arena *a, char *str, const char *suffix);
+static void arena_free(struct arena *a);
+static size_t normalize_path(char *path);
+static bool find_path(const struct hash_table *h, const char *const *keys, const char *path, size_t *index);
+static char *intern_path(struct parser *p, const char *path);
+static char *path_append(struct parser *p, const char *path, const char *word);
+static char *symbol_dup(struct parser *p, const struct symbol_list *list, const char *word);
+static void graph_index_build(struct xmk *m);
+static void graph_free(struct graph *g);
+static void expand_globs(struct parser *p);
+static FILE *open_tmp(const char *name, char *tmp, size_t size);
+static void dir_cache_save(struct parser *p);
+static void dir_cache_free(struct parser *p);
+static void affected_targets(const struct graph *g, const char *const *files, size_t n,
+                            xmk_name_callback callback, void *user);
+static unsigned long long graph_index_state(const char *input, const char *const *dirs, size_t n_dirs);
+static void graph_index_save(const struct xmk *m);
+static bool graph_index_load(struct xmk *m, const char *input);
+static void cleanup(void);
+
+static const syntax_rule syntax_rules[MAX_RULES] =
+{
+    [BUILD] =
+    {
+        .keywords = (const char *const [])
+        {
+            "build",
+            NULL
+        },
+
+        .recipe_list = (const enum recipe *const [])
+        {
+            (const enum recipe[])
+            {
+                KEYWORD,
+                SYMBOL,
+                END
+            },
+            NULL
+        },
+
+        .symbol_callback = set_build_target
+    },
+
+    [TARGET] =
+    {
+        .keywords = (const char *const[])
+        {
+            "target",
+            NULL
+        },
+
+        .recipe_list = (const enum recipe*[])
+        {
+            (const enum recipe[])
+            {
+                KEYWORD,
+                SYMBOL,
+                NESTED_RULE,
+                END
+            },
+            NULL
+        },
+
+        .symbol_callback = add_target,
+        .scope_block_opened = target_scope_block_opened,
+        .scope_block_opened_str = "target_scope_block_opened"
+    },
+
+    [DEFINE_AS] =
+    {
+        .keywords = (const char *const[])
+        {
+            "define",
+            "as",
+            NULL
+        },
+
+         .recipe_list = (const enum recipe *const[])
+        {
+            (const enum recipe[])
+            {
+                KEYWORD,
+                SYMBOL,
+                KEYWORD,
+                SYMBOL,
+                END
+            },
+
+            (const enum recipe[])
+            {
+                KEYWORD,
+                LIST,
+                KEYWORD,
+                SYMBOL,
+                END
+            },
+            NULL
+        },
+
+        .symbol_callback = add_define,
+    },
+
+    [CREATED_USING] =
+    {
+        .keywords = (const char *const[])
+        {
+            "created",
+            "using",
+            NULL
+        },
+
+        .recipe_list = (const enum recipe *const[])
+        {
+            (const enum recipe[])
+            {
+                KEYWORD,
+                KEYWORD,
+                LIST,
+                END
+            },
+            NULL
+        },
+
+        .scope_block_opened = created_using_scope_block_opened,
+        .scope_block_opened_str = "created_using_scope_block_opened"
+    },
+
+    [DEPENDS_ON] =
+    {
+        .keywords = (const char *const[])
+        {
+            "depends",
+            "on",
+            NULL
+        },
+
+        .recipe_list = (const enum recipe *const[])
+        {
+            (const enum recipe[])
+            {
+                KEYWORD,
+                KEYWORD,
+                LIST,
+                END
+            },
+            NULL
+        },
+
+        .scope_block_opened = depends_on_scope_block_opened,
+        .scope_block_opened_str = "depends_on_scope_block_opened"
+    }
+};
+
+static unsigned long long now_us(void)
+{
+#ifdef WIN32
+    return GetTickCount64() * 1000ULL;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+static unsigned long long log_start_us;
+
+static void log_init(void)
+{
+    /* Log output goes to the stdout buffer chosen by the host
+     * application, which is never changed from here. */
+    if (verbose() && !log_start_us)
+        log_start_us = now_us();
+}
+
+#ifndef XMK_NO_LOG
+static void log_message(const char *const prefix, const char *const func,
+                        const int line, const char *const format, va_list ap)
+{
+    const unsigned long long t = now_us() - log_start_us;
+
+    printf("[%s] %llu.%06llu %s:%d: ", prefix, t / 1000000, t % 1000000, func, line);
+    vprintf(format, ap);
+    putchar('\n');
+}
+
+static void logv(const char *const func, const int line, const char *const format, ...)
+{
+    if (verbose() && func && format)
+    {
+        va_list ap;
+        va_start(ap, format);
+        log_message("v", func, line, format, ap);
+        va_end(ap);
+    }
+}
+
+static void logvv(const char *const func, const int line, const char *const format, ...)
+{
+    if (extra_verbose() && func && format)
+    {
+        va_list ap;
+        va_start(ap, format);
+        log_message("vv", func, line, format, ap);
+        va_end(ap);
+    }
+}
+#endif /* XMK_NO_LOG */
+
+static void fatal_error(const char *const func, const int line, const char *const format, ...)
+{
+    if (func && format)
+    {
+        va_list ap;
+        int n = 0;
+
+        if (verbose())
+            n = snprintf(error_message, sizeof error_message, "%s:%d: ", func, line);
+
+        va_start(ap, format);
+        vsnprintf(&error_message[n], sizeof error_message - n, format, ap);
+        va_end(ap);
+
+        if (error_handler)
+            longjmp(*error_handler, 1);
+
+        fprintf(stderr, "[error]: %s\n", error_message);
+        fflush(stderr);
+        cleanup();
+        exit(1);
+    }
+}
+
+static bool verbose(void)
+{
+    return config.verbose;
+}
+
+#ifndef XMK_NO_LOG
+static bool extra_verbose(void)
+{
+    return config.extra_verbose;
+}
+#endif
+
+static int check_syntax(struct parser *const p)
+{
+    size_t from = 0;
+    const char *word;
+    enum parse_state state = SEARCHING;
+    /* Only read while CHECKING, once a rule has been matched. */
+    enum rule rule_checking = DEFINE_AS;
+    bool newline_detected;
+
+    while ((word = get_word(p, p->file_buffer, &from, &newline_detected)))
+    {
+        PROBE2(token, word, p->line);
+
+        if (!strcmp(word, "{"))
+            p->depth++;
+        else if (!strcmp(word, "}") && p->depth && !--p->depth)
+        {
+            /* Defines from the target block go out of scope. */
+            p->defines.n = p->defines.scope_start;
+        }
+
+        if (!strcmp(word, "keyword_list.o"))
+        {
+            volatile int a = 0;
+            a++;
+        }
+
+        switch (state)
+        {
+            case SEARCHING:
+
+                foreach (const syntax_rule, rule, syntax_rules)
+                {
+                    if (check_rule(p, rule, word, &state, &newline_detected))
+                    {
+                        rule_checking = rule - syntax_rules;
+                        break;
+                    }
+                }
+
+            break;
+
+            case CHECKING:
+            {
+                const syntax_rule *const rule = &syntax_rules[rule_checking];
+
+                check_rule(p, rule, word, &state, &newline_detected);
+            }
+            break;
+
+            default:
+                /* Undefined state. */
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Define values being read are kept on a stack, innermost last, on
+ * top of the input file. Only a pointer into each value is kept, so
+ * the stack grows with nesting depth rather than with value sizes. */
+static void push_source(struct parser *const p, const char *const text)
+{
+    if (p->sources.n >= p->sources.size)
+    {
+        const size_t size = p->sources.size ? p->sources.size * 2 : 8;
+        struct source *const list = realloc(p->sources.list, size * sizeof *list);
+
+        if (!list)
+            FATAL_ERROR("Could not allocate define expansion");
+
+        p->sources.list = list;
+        p->sources.size = size;
+    }
+
+    p->sources.list[p->sources.n++] = (struct source){.text = text};
+}
+
+/* Writes the input file with all defines expanded, in a single pass
+ * and without building any target. Words and define values are read
+ * as get_word() does, so memory only grows with nesting depth. Only
+ * define statements and blocks are recognized, so other syntax
+ * errors are not reported. */
+static void preprocess(struct parser *const p, FILE *const out)
+{
+    enum
+    {
+        OUTSIDE,
+        NAME,
+        AS,
+        VALUE
+    } define = OUTSIDE;
+    char name[LENGTHOF(p->word)];
+    /* Lists cannot contain define statements. */
+    bool list = false, list_keyword = false;
+
+    push_source(p, p->file_buffer);
+
+    while (p->sources.n)
+    {
+        struct source *const s = &p->sources.list[p->sources.n - 1];
+        const char *const text = s->text;
+        size_t pos = s->pos, start, len;
+        bool quotes, comment = false;
+
+        for (; text[pos]; pos++)
+        {
+            if (text[pos] == '#')
+                comment = true;
+            else if (text[pos] == '\n')
+            {
+                if (p->sources.n == 1)
+                    p->line++;
+
+                comment = false;
+            }
+            else if (!comment && text[pos] != ' ' && text[pos] != '\t' && text[pos] != '\r')
+                break;
+        }
+
+        if (!text[pos])
+        {
+            fwrite(&text[s->written], 1, pos - s->written, out);
+            p->sources.n--;
+            continue;
+        }
+
+        start = pos;
+        quotes = text[pos] == '\"';
+
+        if (quotes)
+        {
+            start = ++pos;
+
+            while (text[pos] && text[pos] != '\"')
+                pos++;
+
+            len = pos - start;
+
+            if (text[pos])
+                /* Ignore closing quotes. */
+                pos++;
+        }
+        else
+        {
+            size_t parens = 0;
+
+            for (; text[pos] && text[pos] != '\n' && text[pos] != '\r'
+                    && (parens || (text[pos] != ' ' && text[pos] != '\t')); pos++)
+            {
+                if (text[pos] == '(' && pos > start && text[pos - 1] == '$')
+                    parens++;
+                else if (text[pos] == ')' && parens)
+                    parens--;
+            }
+
+            len = pos - start;
+        }
+
+        if (len >= LENGTHOF(p->word) - 1)
+            FATAL_ERROR("maximum word length has been exceeded");
+
+        memcpy(p->word, &text[start], len);
+        p->word[len] = '\0';
+        s->pos = pos;
+
+        if (!quotes && *p->word == '$' && p->word[1] != '$' && p->word[1] != '(')
+        {
+            size_t i;
+
+            if (!p->word[1])
+                FATAL_ERROR("Expected symbol after escaped %s symbol", "$");
+            else if (!find_define(p, &p->word[1], &i))
+                FATAL_ERROR("Undefined symbol %s", p->word);
+            else if (p->sources.n > p->defines.n)
+                FATAL_ERROR("Define %s refers to itself", p->word);
+
+            fwrite(&text[s->written], 1, start - s->written, out);
+            s->written = pos;
+            push_source(p, p->defines.values[i]);
+            continue;
+        }
+
+        /* Blocks and defines are tracked like check_syntax() does. */
+        if (!strcmp(p->word, "{"))
+        {
+            p->depth++;
+            list = list_keyword;
+        }
+        else if (!strcmp(p->word, "on{") || !strcmp(p->word, "using{"))
+            list = true;
+        else if (!strcmp(p->word, "}"))
+        {
+            list = false;
+
+            if (p->depth && !--p->depth)
+                p->defines.n = p->defines.scope_start;
+        }
+
+        list_keyword = !strcmp(p->word, "on") || !strcmp(p->word, "using");
+
+        switch (define)
+        {
+            case OUTSIDE:
+                if (!list && !strcmp(p->word, "define"))
+                    define = NAME;
+            break;
+
+            case NAME:
+                strcpy(name, p->word);
+                define = AS;
+            break;
+
+            case AS:
+                define = strcmp(p->word, "as") ? OUTSIDE : VALUE;
+            break;
+
+            case VALUE:
+                add_define(p, name);
+                add_define(p, p->word);
+                define = OUTSIDE;
+            break;
+        }
+    }
+}
+
+/* Returns the next word from buffer, unless define values are being
+ * read, see push_source(). Defines are expanded by reading their
+ * values in place instead of copying them into the buffer, so the
+ * cost of an expansion does not depend on the size of the input. */
+static const char *get_word(struct parser *const p, const char *buffer, size_t *from, bool* const newline_detected)
+{
+    const char *const file = buffer;
+    size_t *const file_from = from;
+
+    if (buffer && from && newline_detected)
+    {
+        bool comment = false;
+        *newline_detected = false;
+
+        if (p->sources.n)
+        {
+            struct source *const s = &p->sources.list[p->sources.n - 1];
+
+            buffer = s->text;
+            from = &s->pos;
+        }
+
+        char ch = buffer[*from];
+
+        while (1)
+        {
+            switch (ch)
+            {
+                case '#':
+                    comment = true;
+                break;
+
+                case '\0':
+                    if (buffer != file)
+                    {
+                        /* Define value read, back to where it was referenced. */
+                        const bool newline = *newline_detected;
+                        const char *word;
+
+                        p->sources.n--;
+                        word = get_word(p, file, file_from, newline_detected);
+                        *newline_detected |= newline;
+                        return word;
+                    }
+
+                    return NULL;
+
+                default:
+                    if (!comment)
+                        goto whitespaces_skipped;
+                break;
+
+                case '\n':
+                    p->line++;
+                    comment = false;
+                    *newline_detected = true;
+                    /* Fall through. */
+                case '\r':
+                    /* Fall through. */
+                case '\t':
+                    /* Fall through. */
+                case ' ':
+                break;
+            }
+
+            ch = buffer[++(*from)];
+        }
+
+        whitespaces_skipped:
+
+        {
+            if (ch)
+            {
+                /* A non-empty character has been found. */
+                char *const word = p->word;
+                bool quotes = ch == '\"';
+
+                /* Function calls such as "$(dir $(target))" are
+                 * read as a single word, even if they have spaces. */
+                size_t parens = 0;
+
+                if (quotes)
+                    /* Skip first quotes and get next character. */
+                    ch = buffer[++(*from)];
+
+                size_t i = 0;
+                while (	(	(	(quotes)
+                                    &&
+                                (ch != '\"')
+                                    &&
+                                (ch != '\0')	)
+                                ||
+                            (	(!quotes)
+                                    &&
+                                (parens || ((ch != ' ') && (ch != '\t')))
+                                    &&
+                                (ch != '\n')
+                                    &&
+                                (ch != '\r')
+                                    &&
+                                (ch != '\0'))	)
+                                &&
+                        (i < (LENGTHOF(p->word) - 1)))
+                {
+                    if (ch == '(' && i && word[i - 1] == '$')
+                        parens++;
+                    else if (ch == ')' && parens)
+                        parens--;
+
+                    word[i++] = buffer[(*from)++];
+                    ch = buffer[*from];
+                }
+
+                if (i >= LENGTHOF(p->word) - 1)
+                    FATAL_ERROR("maximum word length has been exceeded");
+
+                if (ch == '\n')
+                    p->line++;
+
+                if (quotes && ch)
+                    /* Ignore closing quotes. */
+                    (*from)++;
+
+                word[i] = '\0';
+
+                if (!quotes && strlen(word) > 1)
+                {
+                    if (word[0] == '$')
+                    {
+                        if (word[1] == '$')
+                        {
+                            /* Escaped $ sign found. Return word without the first character. */
+                            return word + 1;
+                        }
+                        else if (word[1] == '(')
+                        {
+                            const char *const value = eval_function(p, word);
+
+                            if (value)
+                            {
+                                return value;
+                            }
+                        }
+                        else if (is_define(p, &word[1]))
+                        {
+                            const size_t i = p->defines.selected_i;
+                            /* Memoized values are never freed, unlike those
+                             * computed while target defines are in scope. */
+                            const char *const value = p->defines.scope_start == p->defines.n
+                                                        ? define_value(p, i) : p->defines.values[i];
+
+                            if (p->sources.n >= p->defines.n)
+                                FATAL_ERROR("Define %s refers to itself", word);
+
+                            push_source(p, value);
+                            p->expansions++;
+                            PROBE3(define_expanded, word, value, p->sources.n);
+                            return get_word(p, file, file_from, newline_detected);
+                        }
+                        else
+                        {
+                            FATAL_ERROR("Undefined symbol %s", word);
+                        }
+                    }
+                }
+                else if (!quotes && *word == '$')
+                {
+                    FATAL_ERROR("Expected symbol after escaped %s symbol", "$");
+                }
+
+                /* Return address to constructed word. */
+                return word;
+            }
+            else
+            {
+                /* Buffer end has been reached. */
+            }
+        }
+    }
+    else
+    {
+        /* Invalid given pointers. */
+        FATAL_ERROR("Invalid given pointers");
+    }
+
+    return NULL;
+}
+
+/* Extension of the file name in path, including its dot, or NULL.
+ * Dots found in directories, or starting the file name as in
+ * ".xmk_log", do not begin an extension. */
+static const char *path_extension(const char *const path)
+{
+    const char *const slash = strrchr(path, '/');
+    const char *const name = slash ? slash + 1 : path;
+    const char *const dot = strrchr(name, '.');
+
+    return dot && dot != name ? dot : NULL;
+}
+
+/* Computes a path function from the arguments stored into its key,
+ * each one starting at key[args[i]] and ending with a new line,
+ * except the last one. Results are slices of the key whenever
+ * possible, so they need no room of their own. */
+static const char *path_function(struct parser *const p, const enum path_function f,
+                                 const char *const key, const size_t *const args)
+{
+    const char *const path = &key[args[0]];
+
+    switch (f)
+    {
+        case PATH_BASENAME:
+        {
+            const char *const ext = path_extension(path);
+
+            return ext ? arena_strndup(&p->strings, path, ext - path) : path;
+        }
+
+        case PATH_EXT:
+        {
+            const char *const ext = path_extension(path);
+
+            return ext ? ext + 1 : path + strlen(path);
+        }
+
+        case PATH_DIR:
+        {
+            const char *const slash = strrchr(path, '/');
+
+            return slash ? arena_strndup(&p->strings, path, slash + 1 - path) : "./";
+        }
+
+        case PATH_NOTDIR:
+        {
+            const char *const slash = strrchr(path, '/');
+
+            return slash ? slash + 1 : path;
+        }
+
+        case PATH_PATSUBST:
+        {
+            const char *const pattern = path;
+            const char *const replacement = &key[args[1]];
+            const char *const text = &key[args[2]];
+            const size_t pattern_len = args[1] - args[0] - 1;
+            const size_t replacement_len = args[2] - args[1] - 1;
+            const size_t text_len = strlen(text);
+            const char *const percent = memchr(pattern, '%', pattern_len);
+            const size_t prefix = percent ? (size_t)(percent - pattern) : pattern_len;
+            const size_t suffix = percent ? pattern_len - prefix - 1 : 0;
+            const char *replace_at;
+
+            if (percent ? text_len < prefix + suffix
+                            || memcmp(text, pattern, prefix)
+                            || memcmp(&text[text_len - suffix], percent + 1, suffix)
+                        : text_len != pattern_len || memcmp(text, pattern, pattern_len))
+                return text;
+            else if (!percent || !(replace_at = memchr(replacement, '%', replacement_len)))
+                return arena_strndup(&p->strings, replacement, replacement_len);
+
+            {
+                const size_t head = replace_at - replacement;
+                const size_t stem = text_len - prefix - suffix;
+                char *const ret = arena_alloc(&p->strings, replacement_len + stem);
+
+                memcpy(ret, replacement, head);
+                memcpy(&ret[head], &text[prefix], stem);
+                memcpy(&ret[head + stem], replace_at + 1, replacement_len - head - 1);
+                ret[replacement_len - 1 + stem] = '\0';
+
+                return ret;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Value of a function argument, which is either
+ * a literal, a define or another function call. */
+static const char *eval_arg(struct parser *const p, const char *const arg)
+{
+    size_t i;
+
+    if (arg[0] != '$')
+        return arg;
+    else if (arg[1] == '$')
+        return arg + 1;
+    else if (arg[1] == '(')
+    {
+        const char *const value = eval_function(p, arg);
+
+        if (!value)
+            FATAL_ERROR("Unknown function %s", arg);
+
+        return value;
+    }
+    else if (find_define(p, &arg[1], &i))
+        return define_value(p, i);
+
+    FATAL_ERROR("Undefined symbol %s", arg);
+    return NULL;
+}
+
+/* Returns the value of a "$(...)" word, or NULL if no known function
+ * is called so the word is kept as is, e.g.: for the shell. Path
+ * functions are computed once for each function and arguments, so
+ * generated manifests calling them again and again allocate nothing. */
+static const char *eval_function(struct parser *const p, const char *const word)
+{
+    const size_t len = strlen(word);
+    const char *const name = word + strlen("$(");
+    const size_t name_len = strcspn(name, " \t)");
+    const char *const end = &word[len - 1];
+    char key[4 * LENGTHOF(p->word)];
+    size_t args[3], n_args = 0, key_len = 1, f, i;
+
+    if (len < strlen("$()") || *end != ')')
+        return NULL;
+    else if (!strcmp(word, "$(target)"))
+    {
+        if (!p->current_scope)
+            FATAL_ERROR("%s must be used inside target scope", word);
+
+        return p->current_scope;
+    }
+    else if (!strcmp(word, "$(target_name)"))
+        return eval_function(p, "$(basename $(target))");
+    else if (!strcmp(word, "$(target_ext)"))
+        return eval_function(p, "$(ext $(target))");
+    else if (!strncmp(name, "dep[", strlen("dep[")))
+        return get_dependency(p, word);
+
+    for (f = 0; f < LENGTHOF(path_functions); f++)
+    {
+        if (strlen(path_functions[f].name) == name_len
+            && !strncmp(name, path_functions[f].name, name_len))
+            break;
+    }
+
+    if (f >= LENGTHOF(path_functions))
+        return NULL;
+
+    key[0] = (char)('0' + f);
+
+    for (const char *arg = name + name_len + strspn(&name[name_len], " \t"); arg < end;)
+    {
+        char buf[LENGTHOF(p->word)];
+        size_t arg_len = 0, depth = 0;
+        const char *value;
+        size_t value_len;
+
+        /* Only the last argument can contain commas. */
+        while (&arg[arg_len] < end
+               && (depth || arg[arg_len] != ',' || n_args + 1 >= path_functions[f].n_args))
+        {
+            if (arg[arg_len] == '(')
+                depth++;
+            else if (arg[arg_len] == ')' && depth)
+                depth--;
+
+            arg_len++;
+        }
+
+        memcpy(buf, arg, arg_len);
+        buf[arg_len] = '\0';
+        value = eval_arg(p, buf);
+        value_len = strlen(value);
+
+        if (key_len + value_len + 2 > sizeof key)
+            FATAL_ERROR("maximum word length has been exceeded");
+
+        if (n_args)
+            key[key_len++] = '\n';
+
+        args[n_args++] = key_len;
+        memcpy(&key[key_len], value, value_len);
+        key_len += value_len;
+        arg += arg_len + (&arg[arg_len] < end);
+    }
+
+    if (n_args != path_functions[f].n_args)
+        FATAL_ERROR("%s expects %zu argument(s)", word, path_functions[f].n_args);
+
+    key[key_len] = '\0';
+
+    if (hash_find(&p->calls.table, (const char *const *)p->calls.keys, key, &i))
+        return p->calls.results[i];
+
+    p->calls.keys = realloc(p->calls.keys, (p->calls.n + 1) * sizeof *p->calls.keys);
+    p->calls.results = realloc(p->calls.results, (p->calls.n + 1) * sizeof *p->calls.results);
+
+    if (!p->calls.keys || !p->calls.results)
+        FATAL_ERROR("Could not allocate function results");
+
+    p->calls.keys[p->calls.n] = arena_strndup(&p->strings, key, key_len);
+    p->calls.results[p->calls.n] = path_function(p, f, p->calls.keys[p->calls.n], args);
+    hash_insert(&p->calls.table, (const char *const *)p->calls.keys, p->calls.n);
+
+    return p->calls.results[p->calls.n++];
+}
+
+static const char *get_dependency(struct parser *const p, const char *const word)
+{
+    /* Format: "$dep[INDEX]". */
+    enum
+    {
+        OPENING_BRACKET,
+        INDEX,
+        CLOSING_BRACKET
+    } state = OPENING_BRACKET;
+    char dep_i_str[8] = {0};
+    size_t dep_i_str_idx = 0;
+
+    for (const char *dep_idx = word + strlen("$(dep");
+        (size_t)(dep_idx - word) < strlen(word);
+        dep_idx++)
+    {
+        const char letter = *dep_idx;
+        switch (state)
+        {
+            case OPENING_BRACKET:
+                if (letter == '[')
+                {
+                    state = INDEX;
+                }
+            break;
+
+            case INDEX:
+                if (letter >= '0' && letter <= '9')
+                {
+                    if (dep_i_str_idx < LENGTHOF(dep_i_str) - 1)
+                    {
+                        dep_i_str[dep_i_str_idx++] = letter;
+                    }
+
+                    switch (*(dep_idx + 1))
+                    {
+                        case '\0':
+                            printf("Missing \"]\" character on dependency index\r\n");
+                        break;
+
+                        case ']':
+                            state = CLOSING_BRACKET;
+                        break;
+
+                        default:
+                        break;
+                    }
+                }
+                else
+                {
+                    FATAL_ERROR("Invalid index %d", letter);
+                }
+            break;
+
+            case CLOSING_BRACKET:
+            break;
+        }
+    }
+
+    dep_i_str[dep_i_str_idx] = '\0';
+
+    {
+        size_t i;
+        /* Accept any numerical base. */
+        const size_t dep_index = strtol(dep_i_str, NULL, 0);
+
+        if (target_exists(p, p->current_scope, &i))
+        {
+            const struct symbol_list *const deps = &p->symbols[DEPENDS_ON];
+
+            if (deps->list && deps->list_size)
+            {
+                const size_t target_deps = deps->list_size[i];
+
+                if (!target_deps)
+                {
+                    FATAL_ERROR("No dependencies are available for target %s", p->current_scope);
+                }
+
+                if (dep_index < target_deps)
+                {
+                    return deps->list[i][dep_index];
+                }
+                else
+                {
+                    FATAL_ERROR("Index %d exceeds number of defined dependencies", dep_index);
+                }
+            }
+            else
+            {
+                FATAL_ERROR("Dependencies list has not been allocated");
+            }
+        }
+    }
+
+    return word;
+}
+
+/* Defines from the target being parsed are looked up
+ * first, so they override global ones with the same name. */
+static bool find_define(const struct parser *const p, const char *const name, size_t *const index)
+{
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        const size_t from = pass ? 0 : p->defines.scope_start;
+        const size_t to = pass ? p->defines.scope_start : p->defines.n;
+
+        for (size_t i = from; i < to; i++)
+        {
+            if (!strcmp(p->defines.names[i], name))
+            {
+                *index = i;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool is_define(struct parser *const p, const char *const name)
+{
+    size_t i;
+
+    if (find_define(p, name, &i))
+    {
+        LOGVV("Detected define \"%s\"->\"%s\"", p->defines.names[i], p->defines.values[i]);
+        p->defines.selected_i = i;
+        return true;
+    }
+
+    return false;
+}
+
+static void expansion_append(struct parser *const p, const char *const str, const size_t len)
+{
+    if (p->expansion.len + len + 1 > p->expansion.size)
+    {
+        const size_t size = (p->expansion.len + len + 1) * 2;
+        char *const data = realloc(p->expansion.data, size);
+
+        if (!data)
+            FATAL_ERROR("Could not expand define due to insufficient memory");
+
+        p->expansion.data = data;
+        p->expansion.size = size;
+    }
+
+    memcpy(&p->expansion.data[p->expansion.len], str, len);
+    p->expansion.len += len;
+    p->expansion.data[p->expansion.len] = '\0';
+}
+
+/* Appends the value of a define, replacing words referring to other
+ * defines by their values, as get_word() would do after splicing the
+ * value into the file buffer. Returns false for values which cannot be
+ * handled the same way, such as quoted text, comments or cycles. */
+static bool append_define(struct parser *const p, const size_t i, const size_t depth, const bool memoized)
+{
+    const char *value = p->defines.values[i];
+
+    if (memoized && p->defines.expanded[i])
+    {
+        expansion_append(p, p->defines.expanded[i], strlen(p->defines.expanded[i]));
+        return true;
+    }
+    else if (depth > p->defines.n || strpbrk(value, "\"#"))
+        return false;
+
+    while (*value)
+    {
+        const size_t spaces = strspn(value, " \t\r\n");
+        size_t len;
+
+        expansion_append(p, value, spaces);
+        value += spaces;
+        len = strcspn(value, " \t\r\n");
+
+        if (len > 1 && value[0] == '$' && value[1] != '$' && value[1] != '(')
+        {
+            char name[LENGTHOF(p->word)];
+            size_t j;
+
+            if (len > LENGTHOF(name))
+                return false;
+
+            memcpy(name, &value[1], len - 1);
+            name[len - 1] = '\0';
+
+            if (!find_define(p, name, &j) || !append_define(p, j, depth + 1, memoized))
+                return false;
+        }
+        else
+            expansion_append(p, value, len);
+
+        value += len;
+    }
+
+    return true;
+}
+
+/* Returns the value a define reference is replaced by, so its nested
+ * defines are not looked up again on every use. Values only depending
+ * on global defines never change, so they are computed once. Defines
+ * from the target being parsed can shadow global ones, so values are
+ * computed again while any exists. */
+static const char *define_value(struct parser *const p, const size_t i)
+{
+    const bool memoized = p->defines.scope_start == p->defines.n;
+
+    if (memoized && p->defines.expanded[i])
+        return p->defines.expanded[i];
+
+    p->expansion.len = 0;
+    expansion_append(p, "", 0);
+
+    if (!append_define(p, i, 0, memoized))
+        return p->defines.values[i];
+    else if (memoized)
+    {
+        p->defines.expanded[i] = arena_strdup(&p->strings, p->expansion.data);
+        return p->defines.expanded[i];
+    }
+
+    return p->expansion.data;
+}
+
+static bool check_rule(struct parser *const p, const syntax_rule *const rule, const char *const word, enum parse_state* const state, bool* const newline_detected)
+{
+    if (rule)
+    {
+        size_t *const step_i = p->step_i;
+        size_t *const keyword_i = p->keyword_i;
+        size_t *const recipe_i = p->recipe_i;
+        const enum recipe *const recipe = rule->recipe_list[recipe_i[p->recursion_level]];
+
+        if (recipe)
+        {
+            const enum recipe step = recipe[step_i[p->recursion_level]];
+
+            switch (step)
+            {
+                case KEYWORD:
+                {
+                    const char *const keyword = rule->keywords[keyword_i[p->recursion_level]];
+
+                    if (keyword)
+                    {
+                        const size_t len = strlen(keyword);
+                        if (!strncmp(word, keyword, len) && len == strlen(word))
+                        {
+                            /* Found valid keyword. */
+                            step_i[p->recursion_level]++;
+                            keyword_i[p->recursion_level]++;
+
+                            {
+                                const enum recipe next_step = recipe[step_i[p->recursion_level]];
+
+                                if (next_step == END)
+                                {
+                                    /* All words for selected rule have been found. */
+                                    step_i[p->recursion_level] = 0;
+                                    keyword_i[p->recursion_level] = 0;
+                                    recipe_i[p->recursion_level] = 0;
+
+                                    if (p->recursion_level)
+                                    {
+                                        p->recursion_level--;
+                                    }
+
+                                    *state = SEARCHING;
+                                }
+                                else
+                                {
+                                    *state = CHECKING;
+                                }
+                            }
+
+                            return true;
+                        }
+                        else if ((strlen(word) == 1) && (word[0] == '}'))
+                        {
+                            if (p->recursion_level)
+                            {
+                                p->recursion_level--;
+                            }
+                        }
+                        else
+                        {
+                            recipe_i[p->recursion_level]++;
+                            /* Try again with another recipe (if available). */
+                            return check_rule(p, rule, word, state, newline_detected);
+                        }
+                    }
+                }
+                break;
+
+                case NESTED_RULE:
+                    if (p->recursion_level < MAX_RECURSION)
+                    {
+                        p->recursion_level++;
+                    }
+
+                    {
+                        bool finished;
+                        scope(p, rule, word, state, &finished);
+                    }
+
+                    *state = SEARCHING;
+                    return true;
+
+                case SYMBOL:
+                    add_symbol(p, rule, word);
+
+                    step_i[p->recursion_level]++;
+                    {
+                        const enum recipe next_step = recipe[step_i[p->recursion_level]];
+
+                        if (next_step == END)
+                        {
+                            step_i[p->recursion_level] = 0;
+                            keyword_i[p->recursion_level] = 0;
+                            recipe_i[p->recursion_level] = 0;
+
+                            if (p->recursion_level)
+                            {
+                                p->recursion_level--;
+                            }
+
+                            *state = SEARCHING;
+                        }
+                        else
+                        {
+                            *state = CHECKING;
+                        }
+                    }
+
+                    return true;
+
+                case LIST:
+                {
+                    bool finished;
+
+                    if (handle_list(p, rule, word, state, *newline_detected, &finished))
+                    {
+                        return true;
+                    }
+                }
+                break;
+
+                case END:
+                    step_i[p->recursion_level] = 0;
+                    keyword_i[p->recursion_level] = 0;
+                    recipe_i[p->recursion_level] = 0;
+
+                    if (p->recursion_level)
+                    {
+                        p->recursion_level--;
+                    }
+
+                    *state = SEARCHING;
+                    return true;
+
+                default:
+                break;
+            }
+        }
+
+        step_i[p->recursion_level] = 0;
+        keyword_i[p->recursion_level] = 0;
+        recipe_i[p->recursion_level] = 0;
+
+        *state = SEARCHING;
+    }
+
+    return false;
+}
+
+static void add_symbol(struct parser *const p, const syntax_rule *const rule, const char *const word)
+{
+    void (*const symbol_callback)(struct parser *, const char *) = rule->symbol_callback;
+
+    if (symbol_callback)
+    {
+        symbol_callback(p, word);
+    }
+}
+
+static void set_build_target(struct parser *const p, const char *const target)
+{
+    for (size_t i = 0; i < p->build_targets.n; i++)
+    {
+        if (!strcmp(p->build_targets.names[i], target))
+        {
+            LOGV("Build target \"%s\" was already set", target);
+            return;
+        }
+    }
+
+    p->build_targets.names = realloc(p->build_targets.names,
+                                (p->build_targets.n + 1) * sizeof *p->build_targets.names);
+
+    if (p->build_targets.names)
+    {
+        p->build_targets.names[p->build_targets.n++] = intern_path(p, target);
+        LOGV("Build target set to \"%s\"", target);
+        return;
+    }
+
+    FATAL_ERROR("Could not allocate build target %s", target);
+}
+
+static void add_target(struct parser *const p, const char *const target)
+{
+    struct symbol_list *const targets = &p->symbols[TARGET];
+    /* Normalized first, so aliases are detected as repeated. */
+    char *const name = intern_path(p, target);
+    const bool repeated = target_exists(p, name, NULL);
+
+    /* The previous target is complete. */
+    expand_globs(p);
+    p->dirs.checked = 0;
+
+    if (!repeated)
+    {
+        if (!targets->list && !targets->list_size)
+        {
+            /* No targets have been allocated yet. */
+            targets->list = malloc(sizeof *targets->list);
+            targets->list_size = malloc(sizeof *targets->list_size);
+
+            if (targets->list_size && targets->list)
+            {
+                *targets->list = malloc(sizeof **targets->list);
+                /* Initialize number of defined targets. */
+                *targets->list_size = 0;
+            }
+        }
+        else if (*targets->list)
+        {
+            /* Resize buffer so the new target can be allocated. */
+            *targets->list = realloc(*targets->list, (*targets->list_size + 1) * sizeof (**targets->list));
+        }
+
+        if (targets->list && *targets->list && targets->list_size)
+        {
+            size_t *const list_size = targets->list_size;
+
+            /* Now, allocate a copy of "target" into targets list. */
+            (*targets->list)[*list_size] = name;
+            hash_insert(&p->target_table, (const char *const *)*targets->list, (*list_size)++);
+
+            LOGV("Targets list: %zu", *list_size);
+
+            /* Avoid walking the whole list unless it is printed. */
+            for (size_t i = 0; verbose() && i < *list_size; i++)
+            {
+                LOGV("\t%zu/%zu: %s", i + 1, *list_size, (*targets->list)[i]);
+            }
+        }
+        else
+        {
+            FATAL_ERROR("An error happened when constructing target list");
+        }
+    }
+    else
+    {
+        FATAL_ERROR("Target %s has already been defined", target);
+    }
+}
+
+static void add_define(struct parser *const p, const char *const define)
+{
+    switch (p->define_state)
+    {
+        case GET_NAME:
+
+            p->defines.names = realloc(p->defines.names, (p->defines.n + 1) * sizeof *p->defines.names);
+
+            if (p->defines.names)
+            {
+                p->defines.names[p->defines.n] = arena_strdup(&p->strings, define);
+                LOGVV("Detected new define name \"%s\"", define);
+                p->define_state = GET_VALUE;
+            }
+
+        break;
+
+        case GET_VALUE:
+
+            p->defines.values = realloc(p->defines.values, (p->defines.n + 1) * sizeof *p->defines.values);
+            p->defines.expanded = realloc(p->defines.expanded, (p->defines.n + 1) * sizeof *p->defines.expanded);
+
+            if (p->defines.values && p->defines.expanded)
+            {
+                p->defines.values[p->defines.n] = arena_strdup(&p->strings, define);
+                p->defines.expanded[p->defines.n] = NULL;
+                LOGVV("Detected new value for \"%s\": \"%s\"", p->defines.names[p->defines.n], define);
+                p->define_state = GET_NAME;
+                p->defines.n++;
+
+                if (!p->depth)
+                    p->defines.scope_start = p->defines.n;
+            }
+
+        break;
+    }
+}
+
+enum parse_state target_scope_block_opened(struct parser *const p)
+{
+    if (!p->symbols[TARGET].list_size)
+    {
+        /* Allocate space for list size for current target. */
+        p->symbols[TARGET].list_size = calloc(1, sizeof *p->symbols[TARGET].list_size);
+    }
+
+    if (p->symbols[TARGET].list_size)
+    {
+        create_basic_tree(p, &p->symbols[DEPENDS_ON]);
+        create_basic_tree(p, &p->symbols[CREATED_USING]);
+
+        return CHECKING;
+    }
+    else
+    {
+        FATAL_ERROR("Could not allocate space for target list");
+    }
+
+    return SEARCHING;
+}
+
+enum parse_state created_using_scope_block_opened(struct parser *const p)
+{
+    expand_globs(p);
+    return CHECKING;
+}
+
+enum parse_state depends_on_scope_block_opened(struct parser *const p)
+{
+    (void)p;
+    return CHECKING;
+}
+
+static bool scope(struct parser *const p, const syntax_rule *const rule, const char *const word, enum parse_state* const state, bool* const finished)
+{
+    *finished = false;
+
+    if (strlen(word) == 1)
+    {
+        switch (*word)
+        {
+            case '{':
+            {
+                /* User has opened a scope block. */
+                LOGVV("Scope block opened");
+                enum parse_state (*const callback)(struct parser *) = rule->scope_block_opened;
+
+                LOGVV("Scope block callback: %p (%s)", callback, rule->scope_block_opened_str);
+
+                if (callback)
+                {
+                    *state = callback(p);
+                    return true;
+                }
+                else
+                {
+                    FATAL_ERROR("Keyword %s does not accept %c", rule->keywords[0], *word);
+                    *state = SEARCHING;
+                    return false;
+                }
+            }
+            break;
+
+            case '}':
+                /* User has closed a scope block. */
+                *state = SEARCHING;
+                return true;
+
+            default:
+                /* 1 byte long word. Keep running this function. */
+            break;
+        }
+    }
+
+    return false;
+}
+
+static bool handle_list(struct parser *const p,
+                        const syntax_rule *const rule,
+                        const char *const word,
+                        enum parse_state* const state,
+                        const bool newline_detected,
+                        bool* const finished)
+{
+    const size_t current_target = *p->symbols[TARGET].list_size - 1;
+    struct symbol_list *const list = &p->symbols[rule - syntax_rules];
+
+    *finished = false;
+
+    if (scope(p, rule, word, state, finished))
+    {
+        return true;
+    }
+
+    /* This point is reached when no scope blocks are found. */
+    if (!list->list)
+    {
+        list->list = malloc(sizeof *list->list);
+
+        if (list->list && list->list_size)
+        {
+            *list->list = malloc(sizeof **list->list);
+
+            if (*list->list)
+            {
+                **list->list = symbol_dup(p, list, word);
+                list->list_size[current_target]++;
+                return true;
+            }
+        }
+    }
+    else if (!list->list[current_target])
+    {
+        list->list[current_target] = malloc(sizeof **list->list);
+
+        if (list->list[current_target])
+        {
+            *(list->list[current_target]) = symbol_dup(p, list, word);
+            list->list_size[current_target]++;
+
+            return true;
+        }
+    }
+    else if (newline_detected)
+    {
+        const size_t new_length = ++(list->list_size[current_target]);
+        list->list[current_target] = realloc(	list->list[current_target],
+                                        sizeof (*list->list[current_target]) * new_length);
+
+        if (list->list[current_target])
+        {
+            list->list[current_target][new_length - 1] = symbol_dup(p, list, word);
+            return true;
+        }
+    }
+    else if (list->list_size)
+    {
+        char ** str = &list->list[current_target][list->list_size[current_target] - 1];
+
+        if (!*str)
+        {
+            *str = symbol_dup(p, list, word);
+            list->list_size[current_target]++;
+            return true;
+        }
+        else if (list == &p->symbols[DEPENDS_ON])
+        {
+            /* Interned paths are shared, so they cannot grow in place. */
+            *str = path_append(p, *str, word);
+            return true;
+        }
+        else
+        {
+            *str = arena_append(&p->strings, *str, word);
+            return true;
+        }
+    }
+
+    FATAL_ERROR("Some error has been detected");
+
+    return false;
+}
+
+static void create_basic_tree(struct parser *const p, struct symbol_list *const dep_list)
+{
+    const size_t n_targets = *p->symbols[TARGET].list_size;
+    const char *const target_name = (*p->symbols[TARGET].list)[n_targets - 1];
+
+    if (!p->current_scope)
+    {
+        p->current_scope = calloc(strlen(target_name) + 1, sizeof *p->current_scope);
+    }
+    else
+    {
+        p->current_scope = realloc(p->current_scope, sizeof (char) * (strlen(target_name) + 1));
+    }
+
+    if (p->current_scope)
+    {
+        strcpy(p->current_scope, target_name);
+    }
+
+    if (!dep_list->list && !dep_list->list_size)
+    {
+        dep_list->list = calloc(1, sizeof *dep_list->list);
+        dep_list->list_size = calloc(1, sizeof *dep_list->list_size);
+
+        if (!dep_list->list || !dep_list->list_size)
+        {
+            FATAL_ERROR("Could not allocate space for dependency list");
+        }
+    }
+    else if (dep_list->list && dep_list->list_size)
+    {
+        dep_list->list = realloc(dep_list->list, n_targets * sizeof (*dep_list->list));
+        dep_list->list_size = realloc(dep_list->list_size, n_targets * sizeof *dep_list->list_size);
+
+        if (dep_list->list && dep_list->list_size)
+        {
+            dep_list->list[n_targets - 1] = NULL;
+            dep_list->list_size[n_targets - 1] = 0;
+        }
+        else
+            FATAL_ERROR("Could not reallocate to %zu", n_targets);
+    }
+}
+
+static int execute_commands(const char *const target, bool *const parent_update_pending)
+{
+    size_t i;
+
+    if (target_exists(&manifest->parser, target, &i))
+    {
+        PROBE2(target_resolved, target, i);
+        return ex_build_target(target, i, parent_update_pending);
+    }
+    else if (!file_exists(target))
+        FATAL_ERROR("Target \"%s\" could not be found on target list", target);
+
+    return 0;
+}
+
+/* Resources consumed by the commands of a target. */
+struct job_usage
+{
+    unsigned long long wall_us;
+    unsigned long long utime_us;
+    unsigned long long stime_us;
+    long maxrss_kib;
+    long inblock;
+    long oublock;
+    long nvcsw;
+    long nivcsw;
+};
+
+/* Build log, stored into BUILD_LOG_FILE_NAME between runs.
+ * Each record keeps resource usage for a given target. */
+static struct
+{
+    char **targets;
+    struct job_usage *usage;
+    /* Whether the record was updated during this run. */
+    bool *updated;
+    /* Whether the last command run for the target failed. */
+    bool *failed;
+    size_t n;
+    struct hash_table table;
+    /* Owns target names. */
+    struct arena names;
+} build_log;
+
+#ifdef WIN32
+static unsigned long long filetime_us(const FILETIME *const ft)
+{
+    const ULARGE_INTEGER t =
+    {
+        .HighPart = ft->dwHighDateTime,
+        .LowPart = ft->dwLowDateTime
+    };
+
+    /* FILETIME is expressed in 100 ns units. */
+    return t.QuadPart / 10;
+}
+
+static int build(const char *const command, struct job_usage *const usage)
+{
+    metrics.jobs_spawned++;
+
+    STARTUPINFOA startup_info = {.cb = sizeof startup_info};
+    PROCESS_INFORMATION process_info = {0};
+    DWORD exit_code = 0;
+
+    if (CreateProcessA
+    (
+        NULL, /*lpApplicationName*/
+        command, /* lpCommandLine */
+        NULL, /*lpProcessAttributes */
+        NULL, /*lpThreadAttributes */
+        false, /*bInheritHandles */
+        0, /* dwCreationFlags*/
+        NULL, /* lpEnvironment */
+        NULL, /* lpCurrentDirectory */
+        &startup_info, /*lpStartupInfo */
+        &process_info /* lpProcessInformation */
+    ))
+    {
+        FILETIME creation, exit, kernel, user;
+
+        WaitForSingleObject(process_info.hProcess, INFINITE);
+        GetExitCodeProcess(process_info.hProcess, &exit_code);
+
+        if (GetProcessTimes(process_info.hProcess, &creation, &exit, &kernel, &user))
+        {
+            usage->wall_us = filetime_us(&exit) - filetime_us(&creation);
+            usage->utime_us = filetime_us(&user);
+            usage->stime_us = filetime_us(&kernel);
+        }
+    }
+    else
+    {
+        exit_code = GetLastError();
+    }
+
+    CloseHandle(startup_info.hStdInput);
+    CloseHandle(startup_info.hStdOutput);
+    CloseHandle(startup_info.hStdError);
+    CloseHandle(process_info.hProcess);
+    CloseHandle(process_info.hThread);
+
+    return exit_code;
+}
+#endif
+
+#ifdef _POSIX_VERSION
+static unsigned long long timeval_us(const struct timeval *const tv)
+{
+    return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static int build(const char *const command, struct job_usage *const usage)
+{
+    struct timespec start, end;
+    pid_t pid;
+
+    metrics.jobs_spawned++;
+    /* Flush pending output so it is not mixed with the child's. */
+    fflush(stdout);
+    pid = fork();
+
+    if (pid < 0)
+    {
+        FATAL_ERROR("Could not create process for command \"%s\"", command);
+    }
+    else if (!pid)
+    {
+        /* Child process. */
+        status_child();
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    PROBE2(job_spawned, command, pid);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    status_waiting(true);
+
+    {
+        int status;
+        struct rusage ru;
+
+        /* system() only provides the exit status, whereas
+         * wait4() also retrieves resources used by the child. */
+        while (wait4(pid, &status, 0, &ru) < 0)
+        {
+            if (errno != EINTR)
+                FATAL_ERROR("Could not wait for command \"%s\"", command);
+
+            /* Interrupted by the status line timer. */
+            status_refresh();
+        }
+
+        status_waiting(false);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        usage->wall_us = (end.tv_sec - start.tv_sec) * 1000000ULL
+            + end.tv_nsec / 1000 - start.tv_nsec / 1000;
+        usage->utime_us = timeval_us(&ru.ru_utime);
+        usage->stime_us = timeval_us(&ru.ru_stime);
+        usage->maxrss_kib = ru.ru_maxrss;
+        usage->inblock = ru.ru_inblock;
+        usage->oublock = ru.ru_oublock;
+        usage->nvcsw = ru.ru_nvcsw;
+        usage->nivcsw = ru.ru_nivcsw;
+        PROBE3(job_reaped, pid, status, usage->wall_us);
+
+        if (WIFEXITED(status))
+            return WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            return 128 + WTERMSIG(status);
+    }
+
+    return 1;
+}
+#endif
+
+static struct job_usage *build_log_find(const char *const target)
+{
+    size_t i;
+
+    if (hash_find(&build_log.table, (const char *const *)build_log.targets, target, &i))
+        return &build_log.usage[i];
+
+    return NULL;
+}
+
+static struct job_usage *build_log_add(const char *const target)
+{
+    const size_t n = build_log.n + 1;
+
+    build_log.targets = realloc(build_log.targets, n * sizeof *build_log.targets);
+    build_log.usage = realloc(build_log.usage, n * sizeof *build_log.usage);
+    build_log.updated = realloc(build_log.updated, n * sizeof *build_log.updated);
+    build_log.failed = realloc(build_log.failed, n * sizeof *build_log.failed);
+
+    if (build_log.targets && build_log.usage && build_log.updated && build_log.failed)
+    {
+        build_log.targets[build_log.n] = arena_strdup(&build_log.names, target);
+        build_log.usage[build_log.n] = (const struct job_usage){0};
+        build_log.updated[build_log.n] = false;
+        build_log.failed[build_log.n] = false;
+        hash_insert(&build_log.table, (const char *const *)build_log.targets, build_log.n);
+        return &build_log.usage[build_log.n++];
+    }
+
+    FATAL_ERROR("Could not allocate build log entry for %s", target);
+
+    return NULL;
+}
+
+static void build_log_update(const char *const target, const struct job_usage *const usage, const bool failed)
+{
+    struct job_usage *u = build_log_find(target);
+
+    if (!u)
+        u = build_log_add(target);
+
+    build_log.failed[u - build_log.usage] = failed;
+
+    {
+        bool *const updated = &build_log.updated[u - build_log.usage];
+
+        if (!*updated)
+        {
+            /* Replace data from previous runs. */
+            *u = *usage;
+            *updated = true;
+        }
+        else
+        {
+            /* Accumulate usage from all commands for a given target. */
+            u->wall_us += usage->wall_us;
+            u->utime_us += usage->utime_us;
+            u->stime_us += usage->stime_us;
+            u->inblock += usage->inblock;
+            u->oublock += usage->oublock;
+            u->nvcsw += usage->nvcsw;
+            u->nivcsw += usage->nivcsw;
+
+            if (usage->maxrss_kib > u->maxrss_kib)
+                u->maxrss_kib = usage->maxrss_kib;
+        }
+    }
+
+    LOGV("Target \"%s\": wall=%llu us, user=%llu us, sys=%llu us, "
+            "maxrss=%ld KiB, inblock=%ld, oublock=%ld, nvcsw=%ld, nivcsw=%ld",
+            target, usage->wall_us, usage->utime_us, usage->stime_us,
+            usage->maxrss_kib, usage->inblock, usage->oublock,
+            usage->nvcsw, usage->nivcsw);
+}
+
+static void build_log_load(void)
+{
+    FILE *const f = fopen(BUILD_LOG_FILE_NAME, "rb");
+
+    if (f)
+    {
+        char target[256];
+        struct job_usage u;
+        int failed;
+
+        while (fscanf(f, "%255s %llu %llu %llu %ld %ld %ld %ld %ld %d",
+                target, &u.wall_us, &u.utime_us, &u.stime_us, &u.maxrss_kib,
+                &u.inblock, &u.oublock, &u.nvcsw, &u.nivcsw, &failed) == 10)
+        {
+            struct job_usage *const entry = build_log_add(target);
+
+            *entry = u;
+            build_log.failed[entry - build_log.usage] = failed;
+        }
+
+        LOGV("%zu entries read from %s", build_log.n, BUILD_LOG_FILE_NAME);
+        fclose(f);
+    }
+}
+
+static void build_log_save(void)
+{
+    if (build_log.n)
+    {
+        FILE *const f = fopen(BUILD_LOG_FILE_NAME, "wb");
+
+        if (f)
+        {
+            for (size_t i = 0; i < build_log.n; i++)
+            {
+                const struct job_usage *const u = &build_log.usage[i];
+
+                fprintf(f, "%s %llu %llu %llu %ld %ld %ld %ld %ld %d\n",
+                        build_log.targets[i], u->wall_us, u->utime_us, u->stime_us,
+                        u->maxrss_kib, u->inblock, u->oublock, u->nvcsw, u->nivcsw,
+                        build_log.failed[i]);
+            }
+
+            fclose(f);
+        }
+        else
+        {
+            fprintf(stderr, "Could not write %s\n", BUILD_LOG_FILE_NAME);
+        }
+    }
+}
+
+static void print_stats(void)
+{
+    struct job_usage total = {0};
+
+    printf("%-32s %10s %10s %10s %12s %8s %8s %8s %8s\n",
+            "target", "wall(ms)", "user(ms)", "sys(ms)", "maxrss(KiB)",
+            "inblock", "oublock", "nvcsw", "nivcsw");
+
+    for (size_t i = 0; i < build_log.n; i++)
+    {
+        if (build_log.updated[i])
+        {
+            const struct job_usage *const u = &build_log.usage[i];
+
+            printf("%-32s %10llu %10llu %10llu %12ld %8ld %8ld %8ld %8ld\n",
+                    build_log.targets[i], u->wall_us / 1000, u->utime_us / 1000,
+                    u->stime_us / 1000, u->maxrss_kib, u->inblock, u->oublock,
+                    u->nvcsw, u->nivcsw);
+
+            total.wall_us += u->wall_us;
+            total.utime_us += u->utime_us;
+            total.stime_us += u->stime_us;
+            total.inblock += u->inblock;
+            total.oublock += u->oublock;
+            total.nvcsw += u->nvcsw;
+            total.nivcsw += u->nivcsw;
+
+            if (u->maxrss_kib > total.maxrss_kib)
+                total.maxrss_kib = u->maxrss_kib;
+        }
+    }
+
+    printf("%-32s %10llu %10llu %10llu %12ld %8ld %8ld %8ld %8ld\n",
+            "total", total.wall_us / 1000, total.utime_us / 1000,
+            total.stime_us / 1000, total.maxrss_kib, total.inblock,
+            total.oublock, total.nvcsw, total.nivcsw);
+}
+
+static void print_memstats_row(const char *const name, const size_t count, const size_t bytes)
+{
+    printf("%-32s %12zu %14zu\n", name, count, bytes);
+}
+
+/* Symbol lists keep one array per target, plus the list of arrays. */
+static size_t symbol_list_bytes(const struct symbol_list *const list,
+                                const size_t n_targets, size_t *const n_symbols)
+{
+    size_t bytes = 0;
+
+    *n_symbols = 0;
+
+    if (list->list && list->list_size)
+    {
+        bytes = n_targets * (sizeof *list->list + sizeof *list->list_size);
+
+        for (size_t i = 0; i < n_targets; i++)
+        {
+            *n_symbols += list->list_size[i];
+            bytes += list->list_size[i] * sizeof **list->list;
+        }
+    }
+
+    return bytes;
+}
+
+/* Memory held by each structure. String contents are only
+ * accounted into arenas, never into structures pointing to them. */
+static void print_memstats(const struct xmk *const m)
+{
+    const struct parser *const p = &m->parser;
+    const size_t n_targets = p->symbols[TARGET].list_size ? *p->symbols[TARGET].list_size : 0;
+    size_t n_edges, n_commands, reserved = 0, used = 0;
+    const size_t edge_bytes = symbol_list_bytes(&p->symbols[DEPENDS_ON], n_targets, &n_edges);
+    const size_t command_bytes = symbol_list_bytes(&p->symbols[CREATED_USING], n_targets, &n_commands);
+    /* Nodes are allocated for the worst case, see graph_index_build(). */
+    const size_t graph_nodes = n_targets + n_edges;
+
+    for (const struct arena_block *b = p->strings.head; b; b = b->next)
+    {
+        reserved += sizeof *b + b->size;
+        used += b->used;
+    }
+
+    printf("%-32s %12s %14s\n", "structure", "count", "bytes");
+    print_memstats_row("strings (reserved)", p->strings.n, reserved);
+    print_memstats_row("strings (used)", p->strings.n, used);
+    /* Included into the rows above. */
+    print_memstats_row("strings (paths)", p->paths.n, p->paths.bytes);
+    print_memstats_row("targets", n_targets,
+            n_targets * (sizeof *p->symbols[TARGET].list + sizeof **p->symbols[TARGET].list)
+            + p->target_table.capacity * sizeof *p->target_table.slots);
+    print_memstats_row("graph nodes", m->graph.n,
+            graph_nodes * sizeof *m->graph.names
+            + m->graph.table.capacity * sizeof *m->graph.table.slots);
+    print_memstats_row("edges", n_edges,
+            edge_bytes + 2 * (graph_nodes + 1 + n_edges) * sizeof *m->graph.deps);
+    print_memstats_row("commands", n_commands, command_bytes);
+    print_memstats_row("defines", p->defines.n,
+            p->defines.n * (sizeof *p->defines.names + sizeof *p->defines.values
+                            + sizeof *p->defines.expanded));
+    print_memstats_row("input buffer", 1, p->buffer_peak);
+    print_memstats_row("expansion buffer (peak)", p->expansions,
+            p->expansion.size + p->sources.size * sizeof *p->sources.list);
+
+    {
+        size_t names = 0;
+
+        for (const struct arena_block *b = build_log.names.head; b; b = b->next)
+            names += sizeof *b + b->size;
+
+        print_memstats_row("build log index", build_log.n,
+                build_log.n * (sizeof *build_log.targets + sizeof *build_log.usage
+                                + sizeof *build_log.updated + sizeof *build_log.failed)
+                + build_log.table.capacity * sizeof *build_log.table.slots + names);
+    }
+
+    printf("%-32s %12s %14ld\n", "peak rss", "-", peak_rss_kib() * 1024);
+}
+
+/* Simulated executor state. Time and memory are virtual,
+ * so scheduling policies can be compared on a real graph
+ * without running any compiler. */
+static struct
+{
+    unsigned long long clock_us;
+    size_t jobs;
+    size_t peak_memory;
+} simulation;
+
+static int simulate(const char *const target, const size_t target_idx)
+{
+    enum
+    {
+        /* Cost model used when no recorded data is available. */
+        BASE_DURATION_US = 10000,
+        DURATION_US_PER_KIB = 1000,
+        BASE_MEMORY = 16 * 1024 * 1024,
+        MEMORY_PER_INPUT_BYTE = 64
+    };
+
+    const struct job_usage *const recorded = build_log_find(target);
+    size_t input_bytes = 0;
+
+    if (recorded)
+    {
+        /* Use data from previous runs, if available. */
+        simulation.clock_us += recorded->wall_us;
+        simulation.jobs++;
+
+        if ((size_t)recorded->maxrss_kib * 1024 > simulation.peak_memory)
+            simulation.peak_memory = recorded->maxrss_kib * 1024;
+
+        LOGV("Simulated target \"%s\" from build log: %llu us, %ld KiB",
+                target, recorded->wall_us, recorded->maxrss_kib);
+
+        return 0;
+    }
+
+    if (manifest->parser.symbols[DEPENDS_ON].list && manifest->parser.symbols[DEPENDS_ON].list_size)
+    {
+        for (size_t dep = 0; dep < manifest->parser.symbols[DEPENDS_ON].list_size[target_idx]; dep++)
+        {
+            long long state[2];
+
+            file_state(manifest->parser.symbols[DEPENDS_ON].list[target_idx][dep], state);
+
+            if (state[1] > 0)
+                input_bytes += state[1];
+        }
+    }
+
+    {
+        const unsigned long long duration = BASE_DURATION_US
+            + (unsigned long long)input_bytes * DURATION_US_PER_KIB / 1024;
+        const size_t memory = BASE_MEMORY + input_bytes * MEMORY_PER_INPUT_BYTE;
+
+        simulation.clock_us += duration;
+        simulation.jobs++;
+
+        if (memory > simulation.peak_memory)
+            simulation.peak_memory = memory;
+
+        LOGV("Simulated target \"%s\": %llu us, %zu bytes",
+                target, duration, memory);
+    }
+
+    return 0;
+}
+
+static void simulation_summary(void)
+{
+    printf("Simulated %zu jobs in %llu.%03llu s of virtual time, peak memory %zu KiB\n",
+            simulation.jobs,
+            simulation.clock_us / 1000000,
+            simulation.clock_us / 1000 % 1000,
+            simulation.peak_memory / 1024);
+}
+
+/* Targets are grouped by file extension, e.g.: "o" or "exe". */
+static const char *metrics_rule(const char *const target)
+{
+    const char *const slash = strrchr(target, '/');
+    const char *const dot = strrchr(slash ? slash : target, '.');
+
+    return dot && dot[1] ? dot + 1 : "none";
+}
+
+static void metrics_label(FILE *const f, const char *value)
+{
+    /* Escape characters as required by Prometheus text format. */
+    for (; *value; value++)
+    {
+        switch (*value)
+        {
+            case '\\':
+                fputs("\\\\", f);
+            break;
+
+            case '"':
+                fputs("\\\"", f);
+            break;
+
+            case '\n':
+                fputs("\\n", f);
+            break;
+
+            default:
+                fputc(*value, f);
+            break;
+        }
+    }
+}
+
+static void metrics_histograms(FILE *const f)
+{
+    static const double buckets[] = {0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300};
+
+    fprintf(f, "# HELP xmk_target_duration_seconds Time spent building each target, by rule.\n"
+            "# TYPE xmk_target_duration_seconds histogram\n");
+
+    for (size_t i = 0; i < build_log.n; i++)
+    {
+        const char *const rule = metrics_rule(build_log.targets[i]);
+        size_t count[LENGTHOF(buckets)] = {0};
+        size_t total = 0;
+        double sum = 0;
+        bool seen = false;
+
+        if (!build_log.updated[i])
+            continue;
+
+        /* Only print each rule once, from its first target. */
+        for (size_t j = 0; j < i; j++)
+        {
+            if (build_log.updated[j] && !strcmp(metrics_rule(build_log.targets[j]), rule))
+            {
+                seen = true;
+                break;
+            }
+        }
+
+        if (seen)
+            continue;
+
+        for (size_t j = i; j < build_log.n; j++)
+        {
+            if (build_log.updated[j] && !strcmp(metrics_rule(build_log.targets[j]), rule))
+            {
+                const double t = build_log.usage[j].wall_us / 1e6;
+
+                for (size_t b = 0; b < LENGTHOF(buckets); b++)
+                {
+                    if (t <= buckets[b])
+                        count[b]++;
+                }
+
+                sum += t;
+                total++;
+            }
+        }
+
+        for (size_t b = 0; b < LENGTHOF(buckets); b++)
+        {
+            fprintf(f, "xmk_target_duration_seconds_bucket{rule=\"");
+            metrics_label(f, rule);
+            fprintf(f, "\",le=\"%g\"} %zu\n", buckets[b], count[b]);
+        }
+
+        fprintf(f, "xmk_target_duration_seconds_bucket{rule=\"");
+        metrics_label(f, rule);
+        fprintf(f, "\",le=\"+Inf\"} %zu\n", total);
+        fprintf(f, "xmk_target_duration_seconds_sum{rule=\"");
+        metrics_label(f, rule);
+        fprintf(f, "\"} %f\n", sum);
+        fprintf(f, "xmk_target_duration_seconds_count{rule=\"");
+        metrics_label(f, rule);
+        fprintf(f, "\"} %zu\n", total);
+    }
+}
+
+static long peak_rss_kib(void)
+{
+#ifdef _POSIX_VERSION
+    struct rusage ru;
+
+    if (!getrusage(RUSAGE_SELF, &ru))
+        return ru.ru_maxrss;
+#endif
+
+    return 0;
+}
+
+/* Writes a snapshot for node-exporter textfile collectors. The file
+ * is written under a temporary name and then renamed, so collectors
+ * never read partial contents. */
+static void metrics_save(const bool success)
+{
+    const char *const path = config.metrics_path;
+
+    if (path)
+    {
+        static const char suffix[] = ".tmp";
+        char *const tmp = malloc(strlen(path) + sizeof suffix);
+        FILE *f;
+
+        if (!tmp)
+            return;
+
+        strcpy(tmp, path);
+        strcat(tmp, suffix);
+        f = fopen(tmp, "wb");
+
+        if (f)
+        {
+            const size_t checked = metrics.up_to_date + metrics.built;
+
+            metrics_histograms(f);
+            fprintf(f,
+                    "# HELP xmk_build_success Whether the last build succeeded.\n"
+                    "# TYPE xmk_build_success gauge\n"
+                    "xmk_build_success %d\n"
+                    "# HELP xmk_build_duration_seconds Time spent building.\n"
+                    "# TYPE xmk_build_duration_seconds gauge\n"
+                    "xmk_build_duration_seconds %f\n"
+                    "# HELP xmk_parse_duration_seconds Time spent parsing the input file.\n"
+                    "# TYPE xmk_parse_duration_seconds gauge\n"
+                    "xmk_parse_duration_seconds %f\n"
+                    "# HELP xmk_targets_up_to_date Targets found to be up to date.\n"
+                    "# TYPE xmk_targets_up_to_date gauge\n"
+                    "xmk_targets_up_to_date %zu\n"
+                    "# HELP xmk_targets_built Targets that had to be built.\n"
+                    "# TYPE xmk_targets_built gauge\n"
+                    "xmk_targets_built %zu\n"
+                    "# HELP xmk_cache_hit_ratio Ratio of checked targets found to be up to date.\n"
+                    "# TYPE xmk_cache_hit_ratio gauge\n"
+                    "xmk_cache_hit_ratio %f\n"
+                    "# HELP xmk_jobs_spawned Number of processes spawned for commands.\n"
+                    "# TYPE xmk_jobs_spawned gauge\n"
+                    "xmk_jobs_spawned %zu\n"
+                    "# HELP xmk_stat_calls Number of file status queries.\n"
+                    "# TYPE xmk_stat_calls gauge\n"
+                    "xmk_stat_calls %zu\n"
+                    "# HELP xmk_peak_rss_bytes Peak resident set size of xmk itself.\n"
+                    "# TYPE xmk_peak_rss_bytes gauge\n"
+                    "xmk_peak_rss_bytes %ld\n",
+                    success,
+                    (now_us() - metrics.build_start_us) / 1e6,
+                    metrics.parse_us / 1e6,
+                    metrics.up_to_date,
+                    metrics.built,
+                    checked ? (double)metrics.up_to_date / checked : 0,
+                    metrics.jobs_spawned,
+                    metrics.stat_calls,
+                    peak_rss_kib() * 1024);
+
+            if (fclose(f) || rename(tmp, path))
+                fprintf(stderr, "Could not write metrics into %s\n", path);
+        }
+        else
+        {
+            fprintf(stderr, "Could not open %s\n", tmp);
+        }
+
+        free(tmp);
+    }
+}
+
+static unsigned long long fingerprint_mix(unsigned long long h, const void *const data, const size_t sz)
+{
+    /* 64-bit FNV-1a. */
+    const unsigned char *const bytes = data;
+
+    for (size_t i = 0; i < sz; i++)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/* Names are normalized as intern_path() does, so different
+ * spellings of the same targets give the same hash. */
+static unsigned long long fingerprint_roots(const char *const *const roots, const size_t n)
+{
+    unsigned long long h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char *const tmp = malloc(strlen(roots[i]) + 1);
+
+        if (!tmp)
+            FATAL_ERROR("Could not allocate path");
+
+        strcpy(tmp, roots[i]);
+        h = fingerprint_mix(h, tmp, normalize_path(tmp) + 1);
+        free(tmp);
+    }
+
+    return h;
+}
+
+/* Modification time and size of a file, or -1 if it does not exist. */
+static void fingerprint_state(const char *const path, long long state[2])
+{
+    struct stat sb;
+
+    state[0] = state[1] = -1;
+    metrics.stat_calls++;
+
+    if (!stat(path, &sb))
+    {
+#ifdef _POSIX_VERSION
+        state[0] = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#else
+        state[0] = sb.st_mtime * 1000000000LL;
+#endif
+        state[1] = sb.st_size;
+    }
+}
+
+static unsigned long long fingerprint_path(const unsigned long long h, const char *const path,
+                                           const long long state[2])
+{
+    return fingerprint_mix(fingerprint_mix(h, path, strlen(path) + 1), state, 2 * sizeof *state);
+}
+
+static unsigned long long fingerprint_file(const unsigned long long h, const char *const path)
+{
+    long long state[2];
+
+    fingerprint_state(path, state);
+
+    return fingerprint_path(h, path, state);
+}
+
+static bool fingerprint_matches(const char *const input, const char *const *const roots, const size_t n_roots)
+{
+    FILE *const f = fopen(FINGERPRINT_FILE_NAME, "rb");
+    bool ret = false;
+
+    if (f)
+    {
+        unsigned long long roots_hash, state, h = 14695981039346656037ULL;
+        size_t n, i = 0;
+        char path[4096];
+
+        if (fscanf(f, "xmk-fingerprint 1 %llx %llx %zu\n", &roots_hash, &state, &n) == 3
+            && roots_hash == fingerprint_roots(roots, n_roots))
+        {
+            for (; i < n && fgets(path, sizeof path, f); i++)
+            {
+                path[strcspn(path, "\n")] = '\0';
+
+                /* The first path is always the input file. */
+                if (!i && strcmp(path, input))
+                    break;
+
+                h = fingerprint_file(h, path);
+            }
+
+            ret = i == n && h == state;
+        }
+
+        LOGV("Fingerprint %s", ret ? "matches" : "does not match");
+        fclose(f);
+    }
+
+    return ret;
+}
+
+/* Files edited or added while commands are running might have
+ * been read before the change, so they must not be recorded as up
+ * to date. Only targets, which the build itself changes, are read
+ * again once it has finished. */
+static void fingerprint_snapshot(const char *const input)
+{
+    const struct graph *const g = &manifest->graph;
+    const size_t n_targets = manifest->parser.symbols[TARGET].list_size ?
+        *manifest->parser.symbols[TARGET].list_size : 0;
+    const size_t n_files = g->n - n_targets + 1;
+    const size_t n_dirs = manifest->parser.glob_dirs.n;
+
+    fingerprint.states = malloc((n_files + n_dirs) * sizeof *fingerprint.states);
+
+    if (!fingerprint.states)
+        FATAL_ERROR("Could not allocate file states");
+
+    fingerprint_state(input, fingerprint.states[0]);
+
+    for (size_t i = n_targets; i < g->n; i++)
+        file_state(g->names[i], fingerprint.states[i - n_targets + 1]);
+
+    for (size_t i = 0; i < n_dirs; i++)
+        fingerprint_state(manifest->parser.glob_dirs.names[i], fingerprint.states[n_files + i]);
+}
+
+/* The fingerprint summarizes the state of the input file, the
+ * requested targets, every file in the graph and every directory
+ * matched against globs after a successful build. If none of them
+ * changed, the next build can exit without parsing anything. It is
+ * stored as a header with both hashes and the number of files,
+ * followed by one path per line. */
+static void fingerprint_save(const char *const input, const char *const *const roots, const size_t n)
+{
+    static const char tmp[] = FINGERPRINT_FILE_NAME ".tmp";
+    FILE *const f = fopen(tmp, "wb");
+
+    if (f)
+    {
+        const struct graph *const g = &manifest->graph;
+        const size_t n_targets = manifest->parser.symbols[TARGET].list_size ?
+            *manifest->parser.symbols[TARGET].list_size : 0;
+        const char *const *const dirs = (const char *const *)manifest->parser.glob_dirs.names;
+        const size_t n_dirs = manifest->parser.glob_dirs.n;
+        const size_t n_files = g->n - n_targets + 1;
+        unsigned long long h = fingerprint_path(14695981039346656037ULL, input, fingerprint.states[0]);
+
+        for (size_t i = 0; i < g->n; i++)
+        {
+            if (i < n_targets)
+            {
+                long long state[2];
+
+                file_state(g->names[i], state);
+                h = fingerprint_path(h, g->names[i], state);
+            }
+            else
+                h = fingerprint_path(h, g->names[i], fingerprint.states[i - n_targets + 1]);
+        }
+
+        /* Files added or removed change the directory mtime. */
+        for (size_t i = 0; i < n_dirs; i++)
+            h = fingerprint_path(h, dirs[i], fingerprint.states[n_files + i]);
+
+        fprintf(f, "xmk-fingerprint 1 %llx %llx %zu\n%s\n",
+                fingerprint_roots(roots, n), h, g->n + n_dirs + 1, input);
+
+        for (size_t i = 0; i < g->n; i++)
+            fprintf(f, "%s\n", g->names[i]);
+
+        for (size_t i = 0; i < n_dirs; i++)
+            fprintf(f, "%s\n", dirs[i]);
+
+        if (fclose(f) || rename(tmp, FINGERPRINT_FILE_NAME))
+            remove(tmp);
+    }
+}
+
+/* Progress status line, rewritten in place while building. */
+static struct
+{
+    bool enabled;
+    bool drawn;
+    enum
+    {
+        PLAN_UNVISITED,
+        PLAN_VISITING,
+        PLAN_CLEAN,
+        PLAN_DIRTY
+    } *plan;
+    bool *finished;
+    size_t total;
+    size_t n_finished;
+    /* Estimated duration of all dirty targets not built yet. */
+    unsigned long long remaining_us;
+    /* Used for targets without recorded durations. */
+    unsigned long long mean_us;
+    const char *running;
+    unsigned long long running_start_us;
+    unsigned long long drawn_us;
+#ifdef _POSIX_VERSION
+    /* Owned by the host process, restored by cleanup(). */
+    struct sigaction prev_action;
+    struct itimerval prev_timer;
+    sigset_t prev_mask;
+#endif
+} status;
+
+static unsigned long long status_estimate(const size_t target_idx)
+{
+    const struct job_usage *const u = build_log_find((*manifest->parser.symbols[TARGET].list)[target_idx]);
+
+    return u ? u->wall_us : status.mean_us;
+}
+
+/* Estimates whether a target will be built, so the number of
+ * jobs and remaining time can be known before building. */
+static bool status_plan(const size_t target_idx)
+{
+    if (status.plan[target_idx] == PLAN_UNVISITED)
+    {
+        const char *const target = (*manifest->parser.symbols[TARGET].list)[target_idx];
+        bool dirty = !file_exists(target);
+
+        status.plan[target_idx] = PLAN_VISITING;
+
+        if (manifest->parser.symbols[DEPENDS_ON].list && manifest->parser.symbols[DEPENDS_ON].list_size)
+        {
+            for (size_t dep = 0; dep < manifest->parser.symbols[DEPENDS_ON].list_size[target_idx]; dep++)
+            {
+                const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][dep];
+                size_t dep_idx;
+
+                if (target_exists(&manifest->parser, dependency, &dep_idx) && status_plan(dep_idx))
+                    dirty = true;
+                else if (!dirty && update_needed(target, dependency))
+                    dirty = true;
+            }
+        }
+
+        status.plan[target_idx] = dirty ? PLAN_DIRTY : PLAN_CLEAN;
+
+        if (dirty)
+        {
+            status.total++;
+            status.remaining_us += status_estimate(target_idx);
+        }
+    }
+
+    return status.plan[target_idx] == PLAN_DIRTY;
+}
+
+#ifdef _POSIX_VERSION
+static void status_alarm(const int sig)
+{
+    /* Only used to interrupt wait4(). */
+    (void)sig;
+}
+
+/* The refresh timer runs for the whole build, but SIGALRM is kept
+ * blocked except while waiting for a command, so no other system
+ * call is interrupted. A refresh due while blocked is delivered as
+ * soon as the next wait starts. */
+static void status_waiting(const bool waiting)
+{
+    if (status.enabled)
+    {
+        sigset_t alarm;
+
+        sigemptyset(&alarm);
+        sigaddset(&alarm, SIGALRM);
+        sigprocmask(waiting ? SIG_UNBLOCK : SIG_BLOCK, &alarm, NULL);
+    }
+}
+
+/* Commands run with the signal mask the host process had. */
+static void status_child(void)
+{
+    if (status.enabled)
+        sigprocmask(SIG_SETMASK, &status.prev_mask, NULL);
+}
+
+static void status_timer(const bool enable)
+{
+    if (status.enabled)
+    {
+        const long us = enable ? STATUS_REFRESH_MS * 1000L : 0;
+        const struct itimerval it =
+        {
+            .it_interval = {.tv_sec = us / 1000000, .tv_usec = us % 1000000},
+            .it_value = {.tv_sec = us / 1000000, .tv_usec = us % 1000000}
+        };
+
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+}
+#endif
+
+static void status_init(const char *const *const targets, const size_t n)
+{
+#ifdef _POSIX_VERSION
+    if (config.no_status || config.simulate || verbose()
+        || !isatty(STDOUT_FILENO)
+        || !manifest->parser.symbols[TARGET].list_size)
+        return;
+
+    {
+        const size_t n_targets = *manifest->parser.symbols[TARGET].list_size;
+        struct sigaction sa = {.sa_handler = status_alarm};
+        sigset_t alarm;
+
+        status.plan = calloc(n_targets, sizeof *status.plan);
+        status.finished = calloc(n_targets, sizeof *status.finished);
+
+        if (!status.plan || !status.finished)
+            return;
+
+        /* SA_RESTART is not set, so wait4() is interrupted on each refresh. */
+        sigemptyset(&sa.sa_mask);
+
+        if (getitimer(ITIMER_REAL, &status.prev_timer)
+            || sigaction(SIGALRM, &sa, &status.prev_action))
+            return;
+
+        sigemptyset(&alarm);
+        sigaddset(&alarm, SIGALRM);
+        sigprocmask(SIG_BLOCK, &alarm, &status.prev_mask);
+    }
+
+    if (build_log.n)
+    {
+        unsigned long long sum = 0;
+
+        for (size_t i = 0; i < build_log.n; i++)
+            sum += build_log.usage[i].wall_us;
+
+        status.mean_us = sum / build_log.n;
+    }
+
+    status.enabled = true;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t target_idx;
+
+        if (target_exists(&manifest->parser, targets[i], &target_idx))
+            status_plan(target_idx);
+    }
+
+    /* Redrawn at a fixed rate until the build ends. */
+    status_timer(true);
+#else
+    (void)targets;
+    (void)n;
+#endif
+}
+
+static void status_refresh(void)
+{
+    if (status.enabled)
+    {
+        printf("\r[%zu/%zu] %d running", status.n_finished, status.total, !!status.running);
+
+        if (status.running)
+        {
+            const unsigned long long elapsed = now_us() - status.running_start_us;
+
+            printf(", slowest: %.40s (%llu.%llus)", status.running,
+                    elapsed / 1000000, elapsed / 100000 % 10);
+        }
+
+        if (status.mean_us)
+        {
+            unsigned long long eta = status.remaining_us;
+
+            if (status.running)
+            {
+                const unsigned long long elapsed = now_us() - status.running_start_us;
+
+                eta -= elapsed < eta ? elapsed : eta;
+            }
+
+            printf(", ETA %llu:%02llu", eta / 60000000, eta / 1000000 % 60);
+        }
+
+        /* Erase any remaining characters from previous line. */
+        printf("\033[K");
+        fflush(stdout);
+        status.drawn = true;
+        status.drawn_us = now_us();
+    }
+}
+
+static void status_clear(void)
+{
+    if (status.drawn)
+    {
+        printf("\r\033[K");
+        fflush(stdout);
+        status.drawn = false;
+    }
+}
+
+/* Jobs shorter than the refresh period never see the timer,
+ * so the line is also redrawn when they start or end, at most
+ * once per period. Quiet mode prints no commands, so this is
+ * the only way the line is drawn there. */
+static void status_update(void)
+{
+    if (!status.drawn || now_us() - status.drawn_us >= STATUS_REFRESH_MS * 1000ULL)
+        status_refresh();
+}
+
+static void status_job_start(const char *const target, const size_t target_idx)
+{
+    if (status.enabled)
+    {
+        status.running = target;
+        status.running_start_us = now_us();
+
+        if (status.plan[target_idx] != PLAN_DIRTY)
+        {
+            /* Planning did not expect this target to be built. */
+            status.plan[target_idx] = PLAN_DIRTY;
+            status.total++;
+            status.remaining_us += status_estimate(target_idx);
+        }
+
+        status_update();
+    }
+}
+
+static void status_job_end(const size_t target_idx)
+{
+    if (status.enabled && !status.finished[target_idx])
+    {
+        const unsigned long long estimate = status_estimate(target_idx);
+
+        status.finished[target_idx] = true;
+        status.n_finished++;
+        status.remaining_us -= estimate < status.remaining_us ? estimate : status.remaining_us;
+        status.running = NULL;
+        status_update();
+    }
+}
+
+/* Builds the MinHash signature of the dependency set of a target,
+ * so overlap between two sets can be estimated by comparing
+ * MINHASH_SIZE values instead of both lists. */
+static void minhash(const size_t target_idx)
+{
+    unsigned long long *const signature = priority.signature[target_idx];
+
+    for (size_t k = 0; k < MINHASH_SIZE; k++)
+        signature[k] = ~0ULL;
+
+    for (size_t dep = 0; dep < manifest->parser.symbols[DEPENDS_ON].list_size[target_idx]; dep++)
+    {
+        const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][dep];
+        const unsigned long long h = fingerprint_mix(14695981039346656037ULL,
+                                                    dependency, strlen(dependency));
+
+        for (size_t k = 0; k < MINHASH_SIZE; k++)
+        {
+            /* Each permutation is derived from a single
+             * hash by a different splitmix64 finalizer seed. */
+            unsigned long long x = h + (k + 1) * 0x9E3779B97F4A7C15ULL;
+
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+            x ^= x >> 31;
+
+            if (x < signature[k])
+                signature[k] = x;
+        }
+    }
+}
+
+/* Returns how many MinHash values two signatures share. */
+static size_t minhash_similarity(const unsigned long long *const a, const unsigned long long *const b)
+{
+    size_t n = 0;
+
+    for (size_t k = 0; k < MINHASH_SIZE; k++)
+        if (a[k] == b[k])
+            n++;
+
+    return n;
+}
+
+static void priority_compute(const size_t target_idx)
+{
+    if (!priority.computed[target_idx])
+    {
+        const char *const target = (*manifest->parser.symbols[TARGET].list)[target_idx];
+        size_t log_idx;
+        bool failed = hash_find(&build_log.table, (const char *const *)build_log.targets,
+                                target, &log_idx) && build_log.failed[log_idx];
+        long long newest = -1;
+
+        /* Set before recursing, so circular dependencies end here. */
+        priority.computed[target_idx] = true;
+
+        for (size_t dep = 0; dep < manifest->parser.symbols[DEPENDS_ON].list_size[target_idx]; dep++)
+        {
+            const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][dep];
+            size_t dep_idx;
+
+            if (target_exists(&manifest->parser, dependency, &dep_idx))
+            {
+                priority_compute(dep_idx);
+                failed |= priority.failed[dep_idx];
+
+                if (priority.newest[dep_idx] > newest)
+                    newest = priority.newest[dep_idx];
+            }
+            else
+            {
+                const long long mtime = file_mtime_ns(dependency);
+
+                if (mtime > newest)
+                    newest = mtime;
+            }
+        }
+
+        priority.failed[target_idx] = failed;
+        priority.newest[target_idx] = newest;
+
+        if (priority.signature)
+            minhash(target_idx);
+    }
+}
+
+struct priority_key
+{
+    bool failed;
+    long long newest;
+    /* NULL for plain files or when --locality is not used. */
+    const unsigned long long *signature;
+    size_t dep;
+};
+
+static int priority_cmp(const void *const a, const void *const b)
+{
+    const struct priority_key *const ka = a, *const kb = b;
+
+    if (ka->failed != kb->failed)
+        return ka->failed ? -1 : 1;
+    else if (ka->newest != kb->newest)
+        return ka->newest > kb->newest ? -1 : 1;
+
+    /* Keep declaration order otherwise. */
+    return ka->dep < kb->dep ? -1 : ka->dep > kb->dep;
+}
+
+/* Reorders keys with equal priority, i.e.: equal "failed" and "newest",
+ * so each target is followed by the remaining one sharing most
+ * dependencies with it, without overriding priority_cmp().
+ * The first one is chosen by its similarity to the last target built.
+ * Greedy selection is quadratic, so large groups are only compared
+ * against a window of following candidates. */
+static void locality_sort(struct priority_key *const keys, const size_t n)
+{
+    enum {WINDOW = 64};
+    const unsigned long long *prev = priority.last;
+
+    for (size_t i = 0; i < n && keys[i].signature; i++)
+    {
+        size_t best = i, best_sim = 0;
+
+        for (size_t j = i; j < n && j < i + WINDOW
+            && keys[j].signature && keys[j].failed == keys[i].failed
+            && keys[j].newest == keys[i].newest; j++)
+        {
+            const size_t sim = prev ? minhash_similarity(prev, keys[j].signature) : 0;
+
+            if (sim > best_sim)
+            {
+                best = j;
+                best_sim = sim;
+            }
+        }
+
+        if (best != i)
+        {
+            const struct priority_key tmp = keys[best];
+
+            /* Shift instead of swapping so remaining keys keep their order. */
+            memmove(&keys[i + 1], &keys[i], (best - i) * sizeof *keys);
+            keys[i] = tmp;
+        }
+
+        prev = keys[i].signature;
+    }
+}
+
+/* Fills "order" with dependency indexes of a target, highest priority first. */
+static void priority_sort(const size_t target_idx, size_t *const order)
+{
+    const size_t n = manifest->parser.symbols[DEPENDS_ON].list_size[target_idx];
+    struct priority_key *const keys = n > 1 ? malloc(n * sizeof *keys) : NULL;
+
+    if (!keys)
+    {
+        /* Nothing to sort, or not enough memory to do it. */
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][i];
+        size_t dep_idx;
+
+        keys[i].dep = i;
+
+        if (target_exists(&manifest->parser, dependency, &dep_idx))
+        {
+            priority_compute(dep_idx);
+            keys[i].failed = priority.failed[dep_idx];
+            keys[i].newest = priority.newest[dep_idx];
+            keys[i].signature = priority.signature ? priority.signature[dep_idx] : NULL;
+        }
+        else
+        {
+            /* Plain files are not built, so their order does not matter. */
+            keys[i].failed = false;
+            keys[i].newest = -1;
+            keys[i].signature = NULL;
+        }
+    }
+
+    qsort(keys, n, sizeof *keys, priority_cmp);
+
+    if (priority.signature)
+        locality_sort(keys, n);
+
+    for (size_t i = 0; i < n; i++)
+        order[i] = keys[i].dep;
+
+    free(keys);
+}
+
+/* Asks the kernel to start reading input files of a target
+ * into page cache, if any of them is newer than the target.
+ * Readahead is done asynchronously by the kernel, so the
+ * job being executed is not delayed. */
+static void prefetch_inputs(const size_t target_idx)
+{
+#if defined(_POSIX_VERSION) && defined(POSIX_FADV_WILLNEED)
+    const char *const target = (*manifest->parser.symbols[TARGET].list)[target_idx];
+    const size_t n = manifest->parser.symbols[DEPENDS_ON].list_size[target_idx];
+    const long long target_mtime = file_mtime_ns(target);
+    bool dirty = target_mtime < 0;
+
+    for (size_t i = 0; i < n && !dirty; i++)
+    {
+        const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][i];
+
+        if (!target_exists(&manifest->parser, dependency, NULL) && file_mtime_ns(dependency) > target_mtime)
+            dirty = true;
+    }
+
+    if (!dirty)
+        return;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][i];
+
+        if (!target_exists(&manifest->parser, dependency, NULL))
+        {
+            const int fd = open(dependency, O_RDONLY);
+
+            if (fd >= 0)
+            {
+                LOGVV("Prefetching %s", dependency);
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+        }
+    }
+#else
+    (void)target_idx;
+#endif
+}
+
+static int ex_build_target(const char *const build_target, const size_t target_idx, bool *const parent_update_pending)
+{
+    bool update_pending = false;
+
+    switch (visited.state[target_idx])
+    {
+        case VISIT_DONE:
+            /* Already evaluated from another parent or root. */
+            if (parent_update_pending && visited.updated[target_idx])
+                *parent_update_pending = true;
+
+            return 0;
+
+        case VISIT_IN_PROGRESS:
+            FATAL_ERROR("Circular dependency detected on target %s", build_target);
+            break;
+
+        case VISIT_PENDING:
+            visited.state[target_idx] = VISIT_IN_PROGRESS;
+            break;
+    }
+
+    if (manifest->parser.symbols[CREATED_USING].list_size)
+    {
+        const size_t n_commands = manifest->parser.symbols[CREATED_USING].list_size[target_idx];
+
+        LOGV("%zu commands have been defined for target \"%s\"", n_commands, build_target);
+
+        for (size_t i = 0; i < n_commands; i++)
+        {
+            LOGV("\tCommand %zu=\"%s\"(%p)", i,
+                    manifest->parser.symbols[CREATED_USING].list[target_idx][i],
+                    (void *)manifest->parser.symbols[CREATED_USING].list[target_idx][i]);
+        }
+
+        if (!file_exists(build_target))
+            update_pending = true;
+
+        if (manifest->parser.symbols[DEPENDS_ON].list && manifest->parser.symbols[DEPENDS_ON].list_size)
+        {
+            const size_t target_deps = manifest->parser.symbols[DEPENDS_ON].list_size[target_idx];
+            LOGV("Target %s has %zu dependencies", build_target, target_deps);
+
+            if (!target_deps && !n_commands)
+                FATAL_ERROR("No build steps or dependencies have"
+                                "been indicated for target %s\n", build_target);
+
+            const size_t order = orders.n;
+
+            if (orders.n + target_deps > orders.size)
+            {
+                const size_t size = orders.n + target_deps > orders.size * 2 ?
+                                    orders.n + target_deps : orders.size * 2;
+                size_t *const deps = realloc(orders.deps, size * sizeof *deps);
+
+                if (!deps)
+                    FATAL_ERROR("Could not allocate dependency list for target %s", build_target);
+
+                orders.deps = deps;
+                orders.size = size;
+            }
+
+            orders.n += target_deps;
+            priority_sort(target_idx, &orders.deps[order]);
+
+            if (!config.simulate)
+            {
+                /* Inputs from dependencies built later are read
+                 * into page cache while earlier ones are built. */
+                for (size_t i = 0; i < target_deps; i++)
+                {
+                    size_t dep_idx;
+
+                    if (target_exists(&manifest->parser, manifest->parser.symbols[DEPENDS_ON].list[target_idx][orders.deps[order + i]], &dep_idx))
+                        prefetch_inputs(dep_idx);
+                }
+            }
+
+            for (size_t i = 0; i < target_deps; i++)
+            {
+                const size_t dep = orders.deps[order + i];
+                const char *const dependency = manifest->parser.symbols[DEPENDS_ON].list[target_idx][dep];
+
+                LOGV("Checking dependency %zu/%zu \"%s\"", dep +1, target_deps, dependency);
+
+                if (dependency)
+                {
+                    execute_commands(dependency, &update_pending);
+
+                    if (!update_pending && update_needed(build_target, dependency))
+                        update_pending = true;
+                } /* if (dependency) */
+            } /* for (size_t i = 0; i < target_deps; i++) */
+
+            orders.n = order;
+        } /* if (manifest->parser.symbols[DEPENDS_ON].list && manifest->parser.symbols[DEPENDS_ON].list_size) */
+    } /* if (manifest->parser.symbols[CREATED_USING].list_size) */
+
+    /* Parent must be updated if any of its dependencies is. */
+    if (parent_update_pending && update_pending)
+        *parent_update_pending = true;
+
+    /* At this point, all dependencies have been resolved. */
+    if (update_pending)
+    {
+        const size_t target_commands = manifest->parser.symbols[CREATED_USING].list_size[target_idx];
+
+        LOGV("Target \"%s\" must be built", build_target);
+        PROBE1(job_queued, build_target);
+        metrics.built++;
+        status_job_start(build_target, target_idx);
+
+        if (priority.signature && priority.computed[target_idx])
+            priority.last = priority.signature[target_idx];
+
+        for (size_t i = 0; i < target_commands; i++)
+        {
+            char *const command = manifest->parser.symbols[CREATED_USING].list[target_idx][i];
+
+            if (command)
+            {
+                if (!config.quiet)
+                {
+                    /* Print resulting command above the status line. */
+                    status_clear();
+                    printf("%s\r\n", command);
+                    status_refresh();
+                }
+
+                if (!config.simulate)
+                {
+                    struct job_usage usage = {0};
+                    const int exit_code = build(command, &usage);
+
+                    build_log_update(build_target, &usage, exit_code);
+
+                    if (exit_code)
+                    {
+                        if (job_done.callback)
+                            job_done.callback(build_target, exit_code, job_done.user);
+
+                        build_log_save();
+                        metrics_save(false);
+                        FATAL_ERROR("Error [%d]", exit_code);
+                    }
+                }
+            }
+            else
+                FATAL_ERROR("Command %d for target %d is empty", i, target_idx);
+        }
+
+        if (config.simulate)
+            simulate(build_target, target_idx);
+
+        status_job_end(target_idx);
+
+        if (!config.simulate)
+            file_state_changed(target_idx);
+
+        /* At this point, all commands for a given target have been executed. */
+        if (!config.simulate && !file_exists(build_target))
+        {
+            FATAL_ERROR("Commands executed for generating \"%s\" were successful, "
+                            "but file has not been generated\n", build_target);
+        }
+
+        if (job_done.callback)
+            job_done.callback(build_target, 0, job_done.user);
+    }
+    else
+    {
+        LOGV("Target \"%s\" is up to date", build_target);
+        metrics.up_to_date++;
+    }
+
+    visited.state[target_idx] = VISIT_DONE;
+    visited.updated[target_idx] = update_pending;
+
+    return 0;
+}
+
+#ifdef WIN32
+static bool update_needed(const char *const target, const char *const dep)
+{
+    bool ret = true;
+
+    if (dep && target && manifest->parser.symbols[TARGET].list_size)
+    {
+        const size_t n_targets = *manifest->parser.symbols[TARGET].list_size;
+
+        HANDLE target_file = CreateFileA(target,
+                                        GENERIC_READ,
+                                        0,
+                                        NULL,
+                                        OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL,
+                                        NULL);
+        HANDLE dep_file = CreateFileA(	dep,
+                                        GENERIC_READ,
+                                        0,
+                                        NULL,
+                                        OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL,
+                                        NULL);
+
+        if ((dep_file == INVALID_HANDLE_VALUE)
+                ||
+             (target_file == INVALID_HANDLE_VALUE))
+        {
+            /* Dependency does not exist, so it must be built. */
+        }
+        else
+        {
+            /* At this point, dependency already exists, but
+             * we must check if it is newer than our target. */
+
+            FILETIME target_write_time;
+
+            if (GetFileTime(target_file, NULL, NULL, &target_write_time))
+            {
+                const ULARGE_INTEGER target_time =
+                {
+                    .HighPart = target_write_time.dwHighDateTime,
+                    .LowPart = target_write_time.dwLowDateTime
+                };
+
+                FILETIME dep_write_time;
+
+                if (GetFileTime(dep_file, NULL, NULL, &dep_write_time))
+                {
+                    const ULARGE_INTEGER dep_time =
+                    {
+                        .HighPart = dep_write_time.dwHighDateTime,
+                        .LowPart = dep_write_time.dwLowDateTime
+                    };
+
+                    ret = dep_time.QuadPart > target_time.QuadPart;
+                }
+                else
+                {
+                    /* Could not extract dependency file modification timedate. */
+                }
+            }
+            else
+            {
+                /* Could not extract target file modification timedate. */
+            }
+        }
+
+        CloseHandle(target_file);
+        CloseHandle(dep_file);
+    }
+
+    return ret;
+}
+#endif
+
+static void file_states_init(void)
+{
+    const size_t n = manifest->graph.n;
+
+    file_states.states = malloc(n * sizeof *file_states.states);
+    file_states.known = calloc(n, sizeof *file_states.known);
+
+    if (n && (!file_states.states || !file_states.known))
+        FATAL_ERROR("Could not allocate file states");
+}
+
+/* Modification time and size of a file, or -1 if it does not exist.
+ * Files outside the graph, or read outside a build, are always
+ * stat'ed again. */
+static void file_state(const char *const file, long long state[2])
+{
+    size_t node;
+
+    if (file_states.known
+        && hash_find(&manifest->graph.table, manifest->graph.names, file, &node))
+    {
+        if (!file_states.known[node])
+        {
+            fingerprint_state(file, file_states.states[node]);
+            file_states.known[node] = true;
+        }
+
+        state[0] = file_states.states[node][0];
+        state[1] = file_states.states[node][1];
+    }
+    else
+        fingerprint_state(file, state);
+}
+
+/* Targets share their node index with the target list. */
+static void file_state_changed(const size_t node)
+{
+    if (file_states.known)
+        file_states.known[node] = false;
+}
+
+/* Returns modification time in nanoseconds, or -1 if file does not exist. */
+static long long file_mtime_ns(const char *const file)
+{
+    long long state[2];
+
+    file_state(file, state);
+
+    return state[0];
+}
+
+/* Same as file_mtime_ns, but without touching the build metrics, since
+ * manifests can be parsed from several threads at once. */
+static long long stat_mtime_ns(const char *const file)
+{
+    struct stat sb;
+
+    if (stat(file, &sb))
+        return -1;
+
+#ifdef _POSIX_VERSION
+    return sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#else
+    return sb.st_mtime * 1000000000LL;
+#endif
+}
+
+#ifdef _POSIX_VERSION
+static bool update_needed(const char *const target, const char *const dep)
+{
+    const long long target_time = file_mtime_ns(target);
+    const long long dep_time = file_mtime_ns(dep);
+    const bool needed = target_time < 0 || dep_time < 0 || dep_time > target_time;
+
+    PROBE3(cache_lookup, target, dep, needed);
+
+    return needed;
+}
+#endif
+
+static bool file_exists(const char *const file)
+{
+    /* stat() is cheaper than opening the file. */
+    return file_mtime_ns(file) >= 0;
+}
+
+static bool target_exists(const struct parser *const p, const char *const target, size_t *const index)
+{
+    if (target && p->symbols[TARGET].list_size)
+    {
+        return hash_find(&p->target_table, (const char *const *)*p->symbols[TARGET].list,
+                        target, index);
+    }
+
+    return false;
+}
+
+static size_t graph_node(struct graph *const g, const char *const name)
+{
+    size_t node;
+
+    if (!hash_find(&g->table, g->names, name, &node))
+    {
+        node = g->n++;
+        g->names[node] = name;
+        hash_insert(&g->table, g->names, node);
+    }
+
+    return node;
+}
+
+static void graph_index_build(struct xmk *const m)
+{
+    const struct symbol_list *const dep_list = &m->parser.symbols[DEPENDS_ON];
+    const size_t n_targets = m->parser.symbols[TARGET].list_size ? *m->parser.symbols[TARGET].list_size : 0;
+    size_t n_edges = 0;
+
+    for (size_t i = 0; dep_list->list_size && i < n_targets; i++)
+        n_edges += dep_list->list_size[i];
+
+    /* Worst case: every dependency is a different file. */
+    m->graph.names = malloc((n_targets + n_edges) * sizeof *m->graph.names);
+    m->graph.dep_start = calloc(n_targets + n_edges + 1, sizeof *m->graph.dep_start);
+    m->graph.deps = malloc(n_edges * sizeof *m->graph.deps);
+    m->graph.rdep_start = calloc(n_targets + n_edges + 1, sizeof *m->graph.rdep_start);
+    m->graph.rdeps = malloc(n_edges * sizeof *m->graph.rdeps);
+
+    if (!m->graph.names || !m->graph.dep_start || !m->graph.rdep_start
+        || (n_edges && (!m->graph.deps || !m->graph.rdeps)))
+    {
+        FATAL_ERROR("Could not allocate dependency graph");
+    }
+
+    for (size_t i = 0; i < n_targets; i++)
+        graph_node(&m->graph, (*m->parser.symbols[TARGET].list)[i]);
+
+    m->graph.n_targets = n_targets;
+
+    for (size_t i = 0, edge = 0; i < n_targets; i++)
+    {
+        m->graph.dep_start[i] = edge;
+
+        for (size_t dep = 0; dep_list->list_size && dep < dep_list->list_size[i]; dep++)
+        {
+            const size_t node = graph_node(&m->graph, dep_list->list[i][dep]);
+
+            m->graph.deps[edge++] = node;
+            /* Count reverse edges first, offsets are computed below. */
+            m->graph.rdep_start[node + 1]++;
+        }
+    }
+
+    /* Plain files have no dependencies. */
+    for (size_t n = n_targets; n <= m->graph.n; n++)
+        m->graph.dep_start[n] = n_edges;
+
+    for (size_t n = 0; n < m->graph.n; n++)
+        m->graph.rdep_start[n + 1] += m->graph.rdep_start[n];
+
+    {
+        size_t *const fill = calloc(m->graph.n + 1, sizeof *fill);
+
+        if (!fill)
+            FATAL_ERROR("Could not allocate dependency graph");
+
+        for (size_t i = 0; i < n_targets; i++)
+        {
+            for (size_t e = m->graph.dep_start[i]; e < m->graph.dep_start[i + 1]; e++)
+            {
+                const size_t node = m->graph.deps[e];
+
+                m->graph.rdeps[m->graph.rdep_start[node] + fill[node]++] = i;
+            }
+        }
+
+        free(fill);
+    }
+
+    LOGV("Dependency graph: %zu nodes, %zu edges", m->graph.n, n_edges);
+}
+
+static void graph_free(struct graph *const g)
+{
+    free(g->names);
+    free(g->table.slots);
+    free(g->dep_start);
+    free(g->deps);
+    free(g->rdep_start);
+    free(g->rdeps);
+    memset(g, 0, sizeof *g);
+}
+
+/* Reports targets that would be rebuilt if any
+ * of the files changed, in build order. */
+static void affected_targets(const struct graph *const g, const char *const *const files,
+                            const size_t n, const xmk_name_callback callback, void *const user)
+{
+    const size_t n_targets = g->n_targets;
+
+    if (!n)
+        FATAL_ERROR("No files were given");
+
+    bool *const affected = calloc(g->n, sizeof *affected);
+    /* Files are queued as given, so repeated ones take room twice,
+     * followed by each target at most once. */
+    size_t *const queue = malloc((n + g->n) * sizeof *queue);
+    size_t *const pending = calloc(n_targets, sizeof *pending);
+    size_t head = 0, tail = 0;
+
+    if ((g->n && (!affected || (n_targets && !pending))) || (n + g->n && !queue))
+        FATAL_ERROR("Could not allocate affected targets");
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t node;
+
+        if (find_path(&g->table, g->names, files[i], &node))
+            queue[tail++] = node;
+        else
+            fprintf(stderr, "%s is not part of the dependency graph\n", files[i]);
+    }
+
+    /* Breadth-first search over reverse edges. */
+    while (head < tail)
+    {
+        const size_t node = queue[head++];
+
+        for (size_t e = g->rdep_start[node]; e < g->rdep_start[node + 1]; e++)
+        {
+            const size_t t = g->rdeps[e];
+
+            if (!affected[t])
+            {
+                affected[t] = true;
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    /* Topological order restricted to affected targets (Kahn). */
+    head = tail = 0;
+
+    for (size_t t = 0; t < n_targets; t++)
+    {
+        if (affected[t])
+        {
+            for (size_t e = g->dep_start[t]; e < g->dep_start[t + 1]; e++)
+            {
+                if (affected[g->deps[e]])
+                    pending[t]++;
+            }
+
+            if (!pending[t])
+                queue[tail++] = t;
+        }
+    }
+
+    while (head < tail)
+    {
+        const size_t t = queue[head++];
+
+        callback(g->names[t], user);
+
+        for (size_t e = g->rdep_start[t]; e < g->rdep_start[t + 1]; e++)
+        {
+            const size_t r = g->rdeps[e];
+
+            if (affected[r] && !--pending[r])
+                queue[tail++] = r;
+        }
+    }
+
+    free(affected);
+    free(queue);
+    free(pending);
+}
+
+/* Queries only need the graph, so it is saved into GRAPH_FILE_NAME
+ * and later queries read it instead of parsing the manifest again.
+ * It is valid while the input file and the directories matched
+ * against globs are unchanged, like the fingerprint. */
+static unsigned long long graph_index_state(const char *const input, const char *const *const dirs,
+                                            const size_t n_dirs)
+{
+    unsigned long long h = fingerprint_file(14695981039346656037ULL, input);
+
+    for (size_t i = 0; i < n_dirs; i++)
+        h = fingerprint_file(h, dirs[i]);
+
+    return h;
+}
+
+/* Stored as a header, the input file and glob directories, one per
+ * line, followed by node names and the edge arrays in binary form. */
+static void graph_index_save(const struct xmk *const m)
+{
+    const struct graph *const g = &m->graph;
+    const char *const *const dirs = (const char *const *)m->parser.glob_dirs.names;
+    const size_t n_dirs = m->parser.glob_dirs.n;
+    const size_t n_edges = g->dep_start[g->n];
+    char tmp[sizeof GRAPH_FILE_NAME + 32];
+    size_t names = 0;
+    FILE *const f = open_tmp(GRAPH_FILE_NAME, tmp, sizeof tmp);
+
+    if (!f)
+        return;
+
+    for (size_t i = 0; i < g->n; i++)
+        names += strlen(g->names[i]) + 1;
+
+    fprintf(f, "xmk-graph 1 %zu %llx %zu %zu %zu %zu %zu\n%s\n", sizeof (size_t),
+            graph_index_state(m->path, dirs, n_dirs), n_dirs, g->n, g->n_targets,
+            n_edges, names, m->path);
+
+    for (size_t i = 0; i < n_dirs; i++)
+        fprintf(f, "%s\n", dirs[i]);
+
+    for (size_t i = 0; i < g->n; i++)
+        fprintf(f, "%s\n", g->names[i]);
+
+    fwrite(g->dep_start, sizeof *g->dep_start, g->n + 1, f);
+    fwrite(g->deps, sizeof *g->deps, n_edges, f);
+    fwrite(g->rdep_start, sizeof *g->rdep_start, g->n + 1, f);
+    fwrite(g->rdeps, sizeof *g->rdeps, n_edges, f);
+
+    {
+        const bool failed = ferror(f);
+
+        if (fclose(f) || failed || rename(tmp, GRAPH_FILE_NAME))
+            remove(tmp);
+    }
+}
+
+/* Returns false if there is no index or it is out of date. */
+static bool graph_index_load(struct xmk *const m, const char *const input)
+{
+    FILE *const f = fopen(GRAPH_FILE_NAME, "rb");
+    struct graph *const g = &m->graph;
+    unsigned long long state, h = 14695981039346656037ULL;
+    size_t word, n_dirs, n_edges, names, i = 0;
+    char path[4096];
+    bool ret = false;
+
+    if (!f)
+        return false;
+    else if (fscanf(f, "xmk-graph 1 %zu %llx %zu %zu %zu %zu %zu",
+                &word, &state, &n_dirs, &g->n, &g->n_targets, &n_edges, &names) != 7
+            || fgetc(f) != '\n' || word != sizeof (size_t) || g->n_targets > g->n)
+        goto end;
+
+    /* The first path is always the input file. */
+    for (; i <= n_dirs && fgets(path, sizeof path, f); i++)
+    {
+        path[strcspn(path, "\n")] = '\0';
+
+        if (!i && strcmp(path, input))
+            break;
+
+        h = fingerprint_file(h, path);
+    }
+
+    if (i <= n_dirs || h != state)
+        goto end;
+
+    m->index_buffer = malloc(names + 1);
+    g->names = malloc(g->n * sizeof *g->names);
+    g->dep_start = malloc((g->n + 1) * sizeof *g->dep_start);
+    g->deps = malloc(n_edges * sizeof *g->deps);
+    g->rdep_start = malloc((g->n + 1) * sizeof *g->rdep_start);
+    g->rdeps = malloc(n_edges * sizeof *g->rdeps);
+
+    if (!m->index_buffer || (g->n && !g->names) || !g->dep_start || !g->rdep_start
+        || (n_edges && (!g->deps || !g->rdeps)))
+        FATAL_ERROR("Could not allocate dependency graph");
+    else if (fread(m->index_buffer, 1, names, f) != names
+            || fread(g->dep_start, sizeof *g->dep_start, g->n + 1, f) != g->n + 1
+            || fread(g->deps, sizeof *g->deps, n_edges, f) != n_edges
+            || fread(g->rdep_start, sizeof *g->rdep_start, g->n + 1, f) != g->n + 1
+            || fread(g->rdeps, sizeof *g->rdeps, n_edges, f) != n_edges
+            || g->dep_start[g->n] != n_edges || g->rdep_start[g->n] != n_edges)
+        goto end;
+
+    for (size_t e = 0; e < n_edges; e++)
+    {
+        if (g->deps[e] >= g->n || g->rdeps[e] >= g->n)
+            goto end;
+    }
+
+    m->index_buffer[names] = '\0';
+
+    {
+        char *name = m->index_buffer;
+
+        for (i = 0; i < g->n && *name; i++)
+        {
+            char *const nl = strchr(name, '\n');
+
+            if (!nl)
+                break;
+
+            *nl = '\0';
+            g->names[i] = name;
+            hash_insert(&g->table, g->names, i);
+            name = nl + 1;
+        }
+    }
+
+    ret = i == g->n;
+    LOGV("%zu nodes read from %s", g->n, GRAPH_FILE_NAME);
+
+end:
+    fclose(f);
+
+    if (!ret)
+        LOGV("%s is out of date", GRAPH_FILE_NAME);
+
+    return ret;
+}
+
+static size_t hash_str(const char *str)
+{
+    /* FNV-1a. */
+    size_t h = 2166136261u;
+
+    while (*str)
+    {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static bool hash_find(const struct hash_table *const h, const char *const *const keys,
+                      const char *const key, size_t *const index)
+{
+    if (h->capacity)
+    {
+        const size_t mask = h->capacity - 1;
+
+        for (size_t slot = hash_str(key) & mask; h->slots[slot]; slot = (slot + 1) & mask)
+        {
+            const size_t i = h->slots[slot] - 1;
+
+            if (!strcmp(keys[i], key))
+            {
+                if (index)
+                    *index = i;
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void hash_insert(struct hash_table *const h, const char *const *const keys, const size_t index)
+{
+    if ((h->n + 1) * 2 > h->capacity)
+    {
+        /* Keep load factor under 50%. Capacity is always a power of two. */
+        const size_t capacity = h->capacity ? h->capacity * 2 : 64;
+        size_t *const slots = calloc(capacity, sizeof *slots);
+
+        if (!slots)
+            FATAL_ERROR("Could not allocate hash table");
+
+        for (size_t i = 0; i < h->capacity; i++)
+        {
+            if (h->slots[i])
+            {
+                size_t slot = hash_str(keys[h->slots[i] - 1]) & (capacity - 1);
+
+                while (slots[slot])
+                    slot = (slot + 1) & (capacity - 1);
+
+                slots[slot] = h->slots[i];
+            }
+        }
+
+        free(h->slots);
+        h->slots = slots;
+        h->capacity = capacity;
+    }
+
+    {
+        size_t slot = hash_str(keys[index]) & (h->capacity - 1);
+
+        while (h->slots[slot])
+            slot = (slot + 1) & (h->capacity - 1);
+
+        h->slots[slot] = index + 1;
+        h->n++;
+    }
+}
+
+/* Returns room for sz bytes. Small strings are packed into
+ * ARENA_BLOCK_SIZE blocks, and larger ones get their own block. */
+static char *arena_alloc(struct arena *const a, const size_t sz)
+{
+    struct arena_block *b = a->head;
+
+    if (!b || b->size - b->used < sz)
+    {
+        const size_t size = sz > ARENA_BLOCK_SIZE ? sz : ARENA_BLOCK_SIZE;
+
+        b = malloc(sizeof *b + size);
+
+        if (!b)
+            FATAL_ERROR("Could not allocate %zu bytes", sz);
+
+        b->used = 0;
+        b->size = size;
+        b->next = a->head;
+        a->head = b;
+    }
+
+    a->last = &b->data[b->used];
+    b->used += sz;
+    a->n++;
+
+    return a->last;
+}
+
+static char *arena_strdup(struct arena *const a, const char *const str)
+{
+    const size_t sz = strlen(str) + 1;
+
+    return memcpy(arena_alloc(a, sz), str, sz);
+}
+
+static char *arena_strndup(struct arena *const a, const char *const str, const size_t len)
+{
+    char *const ret = memcpy(arena_alloc(a, len + 1), str, len);
+
+    ret[len] = '\0';
+
+    return ret;
+}
+
+/* Returns str followed by a space and suffix. str is extended in place
+ * when it was the last allocation and there is room left for it,
+ * which is always the case while a command is being read. */
+static char *arena_append(struct arena *const a, char *const str, const char *const suffix)
+{
+    const size_t len = strlen(str), suffix_len = strlen(suffix);
+    const size_t sz = len + suffix_len + 2;
+    struct arena_block *const b = a->head;
+    char *ret;
+
+    if (str == a->last && b->size - b->used >= suffix_len + 1)
+    {
+        b->used += suffix_len + 1;
+        ret = str;
+    }
+    else
+        ret = memcpy(arena_alloc(a, sz), str, len);
+
+    ret[len] = ' ';
+    memcpy(&ret[len + 1], suffix, suffix_len + 1);
+
+    return ret;
+}
+
+static void arena_free(struct arena *const a)
+{
+    for (struct arena_block *b = a->head; b;)
+    {
+        struct arena_block *const next = b->next;
+
+        free(b);
+        b = next;
+    }
+
+    a->head = NULL;
+    a->last = NULL;
+    a->n = 0;
+}
+
+/* Lexically removes empty and "." components, as well as ".."
+ * components following a directory, so "./obj/../a.o" becomes "a.o".
+ * Symbolic links are not resolved. Returns the new length. */
+static size_t normalize_path(char *const path)
+{
+    char *const start = *path == '/' ? path + 1 : path;
+    char *out = start;
+    const char *in = start;
+
+    while (*in)
+    {
+        const size_t len = strcspn(in, "/");
+
+        if (!len || (len == 1 && *in == '.'))
+            ; /* Nothing to add. */
+        else if (len == 2 && in[0] == '.' && in[1] == '.')
+        {
+            /* Last component written so far. */
+            char *last = out;
+
+            while (last > start && last[-1] != '/')
+                last--;
+
+            if (out > start && !(out - last == 2 && last[0] == '.' && last[1] == '.'))
+                /* Drop it, along with its separator. */
+                out = last > start ? last - 1 : start;
+            else if (start == path)
+            {
+                /* Relative paths can point above the current directory. */
+                if (out > start)
+                    *out++ = '/';
+
+                *out++ = '.';
+                *out++ = '.';
+            }
+
+            /* Otherwise, root has no parent. */
+        }
+        else
+        {
+            if (out > start)
+                *out++ = '/';
+
+            memmove(out, in, len);
+            out += len;
+        }
+
+        in += len;
+
+        if (*in)
+            in++;
+    }
+
+    if (out == path)
+        *out++ = '.';
+
+    *out = '\0';
+
+    return out - path;
+}
+
+/* Looks up a path given by the user, which might not be normalized. */
+static bool find_path(const struct hash_table *const h, const char *const *const keys,
+                      const char *const path, size_t *const index)
+{
+    char *const tmp = malloc(strlen(path) + 1);
+    bool ret;
+
+    if (!tmp)
+        FATAL_ERROR("Could not allocate path");
+
+    strcpy(tmp, path);
+    normalize_path(tmp);
+    ret = hash_find(h, keys, tmp, index);
+    free(tmp);
+
+    return ret;
+}
+
+/* Returns the only copy of path kept by the parser, normalized so
+ * different spellings of the same file become the same node.
+ * Whole paths are kept instead of (directory, file name) pairs,
+ * since every stat(), lookup and callback needs them contiguous.
+ * Path bytes are a small part of the total, see print_memstats(). */
+static char *intern_path(struct parser *const p, const char *const path)
+{
+    char buf[256];
+    const size_t len = strlen(path);
+    char *const tmp = len < sizeof buf ? buf : malloc(len + 1);
+    char *ret;
+    size_t i;
+
+    if (!tmp)
+        FATAL_ERROR("Could not allocate path");
+
+    strcpy(tmp, path);
+    normalize_path(tmp);
+
+    if (hash_find(&p->paths.table, (const char *const *)p->paths.names, tmp, &i))
+        ret = p->paths.names[i];
+    else
+    {
+        p->paths.names = realloc(p->paths.names, (p->paths.n + 1) * sizeof *p->paths.names);
+
+        if (!p->paths.names)
+        {
+            if (tmp != buf)
+                free(tmp);
+
+            FATAL_ERROR("Could not allocate path table");
+        }
+
+        p->paths.names[p->paths.n] = arena_strdup(&p->strings, tmp);
+        p->paths.bytes += strlen(tmp) + 1;
+        hash_insert(&p->paths.table, (const char *const *)p->paths.names, p->paths.n);
+        ret = p->paths.names[p->paths.n++];
+    }
+
+    if (tmp != buf)
+        free(tmp);
+
+    return ret;
+}
+
+/* Interned counterpart of arena_append(). */
+static char *path_append(struct parser *const p, const char *const path, const char *const word)
+{
+    const size_t len = strlen(path);
+    char *const tmp = malloc(len + strlen(word) + 2);
+    char *ret;
+
+    if (!tmp)
+        FATAL_ERROR("Could not allocate path");
+
+    strcpy(tmp, path);
+    tmp[len] = ' ';
+    strcpy(&tmp[len + 1], word);
+    ret = intern_path(p, tmp);
+    free(tmp);
+
+    return ret;
+}
+
+static char *symbol_dup(struct parser *const p, const struct symbol_list *const list, const char *const word)
+{
+    return list == &p->symbols[DEPENDS_ON] ? intern_path(p, word) : arena_strdup(&p->strings, word);
+}
+
+static void parser_init(struct parser *const p)
+{
+    memset(p, 0, sizeof *p);
+    p->line = 1;
+}
+
+static void cleanup_list(struct symbol_list *const list, const size_t n_targets)
+{
+    if (list->list_size && list->list)
+    {
+        /* One list is allocated per target. Symbols
+         * themselves belong to the parser arena. */
+        for (size_t i = 0; i < n_targets; i++)
+        {
+            free(list->list[i]);
+        }
+
+        free(list->list);
+        free(list->list_size);
+    }
+}
+
+static void parser_free(struct parser *const p)
+{
+    struct symbol_list *const targets = &p->symbols[TARGET];
+    const size_t n_targets = targets->list_size ? *targets->list_size : 0;
+
+    cleanup_list(&p->symbols[CREATED_USING], n_targets);
+    cleanup_list(&p->symbols[DEPENDS_ON], n_targets);
+
+    if (targets->list)
+        free(*targets->list);
+
+    free(targets->list);
+    free(targets->list_size);
+    free(p->defines.names);
+    free(p->defines.values);
+    free(p->defines.expanded);
+    free(p->expansion.data);
+    free(p->sources.list);
+    free(p->build_targets.names);
+    free(p->target_table.slots);
+    free(p->paths.names);
+    free(p->paths.table.slots);
+    free(p->calls.keys);
+    free(p->calls.results);
+    free(p->calls.table.slots);
+    dir_cache_free(p);
+    free(p->glob_dirs.names);
+    free(p->file_buffer);
+    free(p->current_scope);
+    /* All strings are released at once. */
+    arena_free(&p->strings);
+
+    parser_init(p);
+}
+
+static void cleanup(void)
+{
+#ifdef _POSIX_VERSION
+    status_timer(false);
+
+    if (status.enabled)
+    {
+        /* A refresh still pending is handled here, before
+         * the host's handler and signal mask are restored. */
+        status_waiting(true);
+        sigprocmask(SIG_SETMASK, &status.prev_mask, NULL);
+        /* Pending time is given back as it was when building started. */
+        setitimer(ITIMER_REAL, &status.prev_timer, NULL);
+        sigaction(SIGALRM, &status.prev_action, NULL);
+    }
+#endif
+
+    free(build_log.targets);
+    free(build_log.usage);
+    free(build_log.updated);
+    free(build_log.failed);
+    free(build_log.table.slots);
+    arena_free(&build_log.names);
+    free(status.plan);
+    free(status.finished);
+    free(visited.state);
+    free(visited.updated);
+    free(priority.computed);
+    free(priority.failed);
+    free(priority.newest);
+    free(priority.signature);
+    free(fingerprint.states);
+    free(file_states.states);
+    free(file_states.known);
+    free(orders.deps);
+
+    /* Leave everything ready for the next build. */
+    memset(&build_log, 0, sizeof build_log);
+    memset(&status, 0, sizeof status);
+    memset(&visited, 0, sizeof visited);
+    memset(&priority, 0, sizeof priority);
+    memset(&fingerprint, 0, sizeof fingerprint);
+    memset(&file_states, 0, sizeof file_states);
+    memset(&orders, 0, sizeof orders);
+    memset(&metrics, 0, sizeof metrics);
+    memset(&simulation, 0, sizeof simulation);
+    memset(&job_done, 0, sizeof job_done);
+    manifest = NULL;
+}
+
+static bool is_glob(const char *const path)
+{
+    return strpbrk(path, "*?[");
+}
+
+/* Shell-like matching of a single path component: '*' matches any
+ * string, '?' matches any character and [...] matches a set of
+ * characters, which can be negated by '!' or '^' and contain ranges. */
+static bool glob_match(const char *pattern, const char *name)
+{
+    const char *star = NULL, *retry = NULL;
+
+    while (*name)
+    {
+        if (*pattern == '*')
+        {
+            /* Try to match as few characters as possible first. */
+            star = ++pattern;
+            retry = name;
+            continue;
+        }
+        else if (*pattern == '[')
+        {
+            const char *p = pattern + 1;
+            const bool negate = *p == '!' || *p == '^';
+            bool match = false;
+
+            if (negate)
+                p++;
+
+            /* A leading ']' is part of the set. */
+            do
+            {
+                if (p[1] == '-' && p[2] && p[2] != ']')
+                {
+                    match |= *p <= *name && *name <= p[2];
+                    p += 3;
+                }
+                else
+                    match |= *p++ == *name;
+            } while (*p && *p != ']');
+
+            if (*p && match != negate)
+            {
+                pattern = p + 1;
+                name++;
+                continue;
+            }
+        }
+        else if (*pattern == '?' || *pattern == *name)
+        {
+            pattern++;
+            name++;
+            continue;
+        }
+
+        if (!star)
+            return false;
+
+        pattern = star;
+        name = ++retry;
+    }
+
+    while (*pattern == '*')
+        pattern++;
+
+    return !*pattern;
+}
+
+static int name_cmp(const void *const a, const void *const b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void dir_cache_add(struct parser *const p, const char *const path)
+{
+    const size_t n = p->dirs.n + 1;
+
+    p->dirs.paths = realloc(p->dirs.paths, n * sizeof *p->dirs.paths);
+    p->dirs.mtime_ns = realloc(p->dirs.mtime_ns, n * sizeof *p->dirs.mtime_ns);
+    p->dirs.entries = realloc(p->dirs.entries, n * sizeof *p->dirs.entries);
+    p->dirs.n_entries = realloc(p->dirs.n_entries, n * sizeof *p->dirs.n_entries);
+    p->dirs.used = realloc(p->dirs.used, n * sizeof *p->dirs.used);
+
+    if (!p->dirs.paths || !p->dirs.mtime_ns || !p->dirs.entries
+        || !p->dirs.n_entries || !p->dirs.used)
+        FATAL_ERROR("Could not allocate directory cache");
+
+    p->dirs.paths[p->dirs.n] = arena_strdup(&p->dirs.strings, path);
+    p->dirs.mtime_ns[p->dirs.n] = -1;
+    p->dirs.entries[p->dirs.n] = NULL;
+    p->dirs.n_entries[p->dirs.n] = 0;
+    p->dirs.used[p->dirs.n] = false;
+    hash_insert(&p->dirs.table, (const char *const *)p->dirs.paths, p->dirs.n++);
+}
+
+static void dir_cache_add_entry(struct parser *const p, const size_t dir, const char *const name)
+{
+    char ***const entries = &p->dirs.entries[dir];
+    size_t *const n = &p->dirs.n_entries[dir];
+
+    *entries = realloc(*entries, (*n + 1) * sizeof **entries);
+
+    if (!*entries)
+        FATAL_ERROR("Could not allocate directory cache");
+
+    (*entries)[(*n)++] = arena_strdup(&p->dirs.strings, name);
+}
+
+static void dir_cache_load(struct parser *const p)
+{
+    FILE *const f = fopen(DIR_CACHE_FILE_NAME, "rb");
+
+    p->dirs.loaded = true;
+
+    if (f)
+    {
+        char line[4096];
+
+        if (fgets(line, sizeof line, f) && !strcmp(line, "xmk-dirs 1\n"))
+        {
+            long long mtime_ns;
+            size_t n;
+            int offset;
+
+            while (fgets(line, sizeof line, f)
+                    && sscanf(line, "%lld %zu %n", &mtime_ns, &n, &offset) == 2)
+            {
+                const size_t dir = p->dirs.n;
+
+                line[strcspn(line, "\n")] = '\0';
+                dir_cache_add(p, &line[offset]);
+                p->dirs.mtime_ns[dir] = mtime_ns;
+
+                for (size_t i = 0; i < n && fgets(line, sizeof line, f); i++)
+                {
+                    line[strcspn(line, "\n")] = '\0';
+                    dir_cache_add_entry(p, dir, line);
+                }
+            }
+        }
+
+        LOGV("%zu directories read from %s", p->dirs.n, DIR_CACHE_FILE_NAME);
+        fclose(f);
+    }
+}
+
+/* Opens a new file, to be renamed to name once written. Other
+ * processes or threads may be saving the same file at the same
+ * time, so each one writes its own file. Returns NULL on error. */
+static FILE *open_tmp(const char *const name, char *const tmp, const size_t size)
+{
+    FILE *f;
+
+#ifdef _POSIX_VERSION
+    int fd;
+
+    snprintf(tmp, size, "%s.XXXXXX", name);
+
+    /* mkstemp creates the file as private to the user. */
+    if ((fd = mkstemp(tmp)) < 0)
+        f = NULL;
+    else if (fchmod(fd, 0644) || !(f = fdopen(fd, "wb")))
+    {
+        f = NULL;
+        close(fd);
+        remove(tmp);
+    }
+#else
+    snprintf(tmp, size, "%s.%lu.%lu.tmp", name,
+        (unsigned long)GetCurrentProcessId(), (unsigned long)GetCurrentThreadId());
+    f = fopen(tmp, "wb");
+#endif
+
+    if (!f)
+        fprintf(stderr, "Could not write %s\n", name);
+
+    return f;
+}
+
+/* Directories used by other manifests are kept as well. */
+static void dir_cache_save(struct parser *const p)
+{
+    char tmp[sizeof DIR_CACHE_FILE_NAME + 32];
+    FILE *f;
+
+    if (!p->dirs.modified || !(f = open_tmp(DIR_CACHE_FILE_NAME, tmp, sizeof tmp)))
+        return;
+
+    fprintf(f, "xmk-dirs 1\n");
+
+    for (size_t i = 0; i < p->dirs.n; i++)
+    {
+        fprintf(f, "%lld %zu %s\n", p->dirs.mtime_ns[i], p->dirs.n_entries[i], p->dirs.paths[i]);
+
+        for (size_t j = 0; j < p->dirs.n_entries[i]; j++)
+            fprintf(f, "%s\n", p->dirs.entries[i][j]);
+    }
+
+    if (fclose(f) || rename(tmp, DIR_CACHE_FILE_NAME))
+        remove(tmp);
+}
+
+static void dir_cache_free(struct parser *const p)
+{
+    for (size_t i = 0; i < p->dirs.n; i++)
+        free(p->dirs.entries[i]);
+
+    free(p->dirs.paths);
+    free(p->dirs.mtime_ns);
+    free(p->dirs.entries);
+    free(p->dirs.n_entries);
+    free(p->dirs.used);
+    free(p->dirs.table.slots);
+    free(p->dirs.expanded);
+    arena_free(&p->dirs.strings);
+    memset(&p->dirs, 0, sizeof p->dirs);
+}
+
+static void dir_scan(struct parser *const p, const size_t dir)
+{
+    const char *const path = p->dirs.paths[dir];
+
+    p->dirs.n_entries[dir] = 0;
+
+#ifdef WIN32
+    {
+        char pattern[MAX_PATH];
+        WIN32_FIND_DATAA data;
+        HANDLE h;
+
+        snprintf(pattern, sizeof pattern, "%s\\*", path);
+
+        if ((h = FindFirstFileA(pattern, &data)) != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                if (strcmp(data.cFileName, ".") && strcmp(data.cFileName, ".."))
+                    dir_cache_add_entry(p, dir, data.cFileName);
+            } while (FindNextFileA(h, &data));
+
+            FindClose(h);
+        }
+    }
+#else
+    {
+        DIR *const d = opendir(path);
+
+        if (d)
+        {
+            const struct dirent *e;
+
+            while ((e = readdir(d)))
+            {
+                /* Newlines cannot be stored into the cache file. */
+                if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")
+                    && !strchr(e->d_name, '\n'))
+                    dir_cache_add_entry(p, dir, e->d_name);
+            }
+
+            closedir(d);
+        }
+    }
+#endif
+
+    if (p->dirs.n_entries[dir])
+        qsort(p->dirs.entries[dir], p->dirs.n_entries[dir], sizeof *p->dirs.entries[dir], name_cmp);
+
+    LOGV("Scanned directory \"%s\": %zu entries", path, p->dirs.n_entries[dir]);
+}
+
+/* Returns the index of a directory in the cache, scanning
+ * it again only if it has been modified since last run. */
+static size_t dir_entries(struct parser *const p, const char *const path)
+{
+    size_t dir;
+
+    if (!p->dirs.loaded)
+        dir_cache_load(p);
+
+    if (!hash_find(&p->dirs.table, (const char *const *)p->dirs.paths, path, &dir))
+    {
+        dir = p->dirs.n;
+        dir_cache_add(p, path);
+    }
+
+    if (!p->dirs.used[dir])
+    {
+        const long long mtime_ns = stat_mtime_ns(path);
+
+        p->glob_dirs.names = realloc(p->glob_dirs.names,
+                                (p->glob_dirs.n + 1) * sizeof *p->glob_dirs.names);
+
+        if (!p->glob_dirs.names)
+            FATAL_ERROR("Could not allocate glob directories");
+
+        p->glob_dirs.names[p->glob_dirs.n++] = intern_path(p, path);
+        p->dirs.used[dir] = true;
+
+        if (mtime_ns < 0 || mtime_ns != p->dirs.mtime_ns[dir])
+        {
+            dir_scan(p, dir);
+            /* Changes made within the same second could go unnoticed
+             * on coarse file systems, so such listings are not reused. */
+            p->dirs.mtime_ns[dir] = mtime_ns / 1000000000 < time(NULL) - 1 ? mtime_ns : -1;
+            p->dirs.modified = true;
+        }
+        else
+            LOGV("Directory \"%s\" is unchanged", path);
+    }
+
+    return dir;
+}
+
+/* Appends the paths matching a glob, in alphabetical order.
+ * Wildcards are only supported on the last path component.
+ * Hidden files are only matched by patterns starting with '.'. */
+static void glob_expand(struct parser *const p, const char *const pattern,
+                        char ***const out, size_t *const n)
+{
+    const char *const slash = strrchr(pattern, '/');
+    const char *const base = slash ? slash + 1 : pattern;
+    const size_t dir_len = slash ? (size_t)(slash - pattern) : 0;
+    char *const dir_path = malloc(dir_len + 2);
+    size_t dir, matched = 0;
+
+    if (!dir_path)
+        FATAL_ERROR("Could not allocate glob");
+    else if (slash)
+    {
+        memcpy(dir_path, pattern, dir_len);
+        /* A leading slash refers to the root directory. */
+        dir_path[dir_len ? dir_len : 1] = '\0';
+        dir_path[0] = dir_len ? dir_path[0] : '/';
+    }
+    else
+        strcpy(dir_path, ".");
+
+    if (is_glob(dir_path))
+    {
+        free(dir_path);
+        FATAL_ERROR("Wildcards are only supported on file names: %s", pattern);
+    }
+
+    dir = dir_entries(p, dir_path);
+    free(dir_path);
+
+    for (size_t i = 0; i < p->dirs.n_entries[dir]; i++)
+    {
+        const char *const entry = p->dirs.entries[dir][i];
+
+        if ((*entry != '.' || *base == '.') && glob_match(base, entry))
+        {
+            const size_t len = dir_len + strlen(entry) + 2;
+            char *const path = malloc(len);
+
+            if (!path)
+                FATAL_ERROR("Could not allocate glob");
+
+            snprintf(path, len, "%.*s%s%s", (int)dir_len, pattern, slash ? "/" : "", entry);
+            *out = realloc(*out, (*n + 1) * sizeof **out);
+
+            if (!*out)
+            {
+                free(path);
+                FATAL_ERROR("Could not allocate glob");
+            }
+
+            (*out)[(*n)++] = intern_path(p, path);
+            free(path);
+            matched++;
+        }
+    }
+
+    LOGV("Glob \"%s\" matched %zu files", pattern, matched);
+}
+
+/* Replaces glob dependencies of the target being parsed by the
+ * paths matching them. It must be done before its commands are
+ * read, so $(dep[n]) refers to the expanded list. */
+static void expand_globs(struct parser *const p)
+{
+    struct symbol_list *const list = &p->symbols[DEPENDS_ON];
+    const size_t n_targets = p->symbols[TARGET].list_size ? *p->symbols[TARGET].list_size : 0;
+    const size_t target = n_targets - 1;
+    /* Owned by the parser, so it is released on errors. */
+    char ***const deps = &p->dirs.expanded;
+    size_t n, j;
+
+    if (!n_targets || !list->list || !list->list_size)
+        return;
+
+    for (j = p->dirs.checked; j < list->list_size[target] && !is_glob(list->list[target][j]); j++)
+        ;
+
+    if (j < list->list_size[target])
+    {
+        /* Dependencies before the first glob are kept as they are. */
+        if (j)
+        {
+            *deps = malloc(j * sizeof **deps);
+
+            if (!*deps)
+                FATAL_ERROR("Could not allocate dependency list");
+
+            memcpy(*deps, list->list[target], j * sizeof **deps);
+        }
+
+        for (n = j; j < list->list_size[target]; j++)
+        {
+            char *const dep = list->list[target][j];
+
+            if (is_glob(dep))
+                glob_expand(p, dep, deps, &n);
+            else
+            {
+                *deps = realloc(*deps, (n + 1) * sizeof **deps);
+
+                if (!*deps)
+                    FATAL_ERROR("Could not allocate dependency list");
+
+                (*deps)[n++] = dep;
+            }
+        }
+
+        free(list->list[target]);
+        list->list[target] = *deps;
+        list->list_size[target] = n;
+        *deps = NULL;
+    }
+
+    /* Paths matched are never expanded again. */
+    p->dirs.checked = list->list_size[target];
+}
+
+/* Reads the whole input file into the parser buffer. */
+static void read_file(struct parser *const p, const char *const path)
+{
+    FILE *const f = fopen(path, "rb");
+    size_t sz, read_bytes = 0;
+
+    if (!f)
+        FATAL_ERROR("Input file %s could not be opened", path);
+
+    /* Calculate file size and return to initial position. */
+    fseek(f, 0, SEEK_END);
+    sz = ftell(f);
+    rewind(f);
+    p->file_buffer = malloc((sz + 1) * sizeof *p->file_buffer);
+
+    if (p->file_buffer)
+        read_bytes = fread(p->file_buffer, sizeof *p->file_buffer, sz, f);
+
+    /* Closed before any error, so nothing is leaked by the jump. */
+    fclose(f);
+
+    if (!p->file_buffer)
+        FATAL_ERROR("Cannot allocate buffer for file data");
+    else if (read_bytes != sz)
+        FATAL_ERROR("Could not read %s succesfully. "
+                    "Only %zu/%zu bytes could be read",
+                    path, read_bytes, sz);
+
+    p->file_buffer[sz] = '\0';
+    p->buffer_peak = sz + 1;
+    LOGV("File %s was opened successfully", path);
+}
+
+static void load(struct xmk *const m, const char *const path)
+{
+    const unsigned long long parse_start = now_us();
+
+    m->path = malloc((strlen(path) + 1) * sizeof *m->path);
+
+    if (!m->path)
+        FATAL_ERROR("Could not allocate manifest");
+
+    strcpy(m->path, path);
+    parser_init(&m->parser);
+    read_file(&m->parser, path);
+    check_syntax(&m->parser);
+    /* The last target is complete. */
+    expand_globs(&m->parser);
+    dir_cache_save(&m->parser);
+    dir_cache_free(&m->parser);
+    /* Not needed once all symbols have been extracted. */
+    free(m->parser.file_buffer);
+    m->parser.file_buffer = NULL;
+    /* Interned paths stay in the arena, but no more are added. */
+    free(m->parser.paths.names);
+    free(m->parser.paths.table.slots);
+    m->parser.paths.names = NULL;
+    memset(&m->parser.paths.table, 0, sizeof m->parser.paths.table);
+    /* Same for results from path functions. */
+    free(m->parser.calls.keys);
+    free(m->parser.calls.results);
+    free(m->parser.calls.table.slots);
+    memset(&m->parser.calls, 0, sizeof m->parser.calls);
+    graph_index_build(m);
+    m->parse_us = now_us() - parse_start;
+}
+
+/* Resolves target names given by the user into their normalized
+ * form, using targets from "build" statements when none are given.
+ * Returns the number of roots. */
+static size_t resolve_roots(struct xmk *const m, const char *const *const targets,
+                            const size_t n, const char *const **const roots)
+{
+    *roots = (const char *const *)m->parser.build_targets.names;
+
+    if (n)
+    {
+        m->roots = realloc(m->roots, n * sizeof *m->roots);
+
+        if (!m->roots)
+            FATAL_ERROR("Could not allocate target list");
+
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t idx;
+
+            /* Unknown names are kept as given, so errors refer to them. */
+            if (m->parser.symbols[TARGET].list_size
+                && find_path(&m->parser.target_table,
+                            (const char *const *)*m->parser.symbols[TARGET].list,
+                            targets[i], &idx))
+                m->roots[i] = (*m->parser.symbols[TARGET].list)[idx];
+            else
+                m->roots[i] = targets[i];
+        }
+
+        *roots = m->roots;
+        return n;
+    }
+    else if (m->parser.build_targets.n)
+        return m->parser.build_targets.n;
+
+    FATAL_ERROR("No build target has been defined. "
+                    "Please add \"build TARGET_NAME\" "
+                    "or pass target names as arguments");
+
+    return 0;
+}
+
+static int build_roots(struct xmk *const m, const char *const *const targets, const size_t n,
+                        const xmk_job_callback callback, void *const user)
+{
+    const size_t n_targets = m->parser.symbols[TARGET].list_size ?
+        *m->parser.symbols[TARGET].list_size : 0;
+    const char *const *roots;
+    const size_t n_roots = resolve_roots(m, targets, n, &roots);
+    int ret = 0;
+
+    manifest = m;
+    job_done.callback = callback;
+    job_done.user = user;
+    metrics.parse_us = m->parse_us;
+    visited.state = calloc(n_targets, sizeof *visited.state);
+    visited.updated = calloc(n_targets, sizeof *visited.updated);
+    priority.computed = calloc(n_targets, sizeof *priority.computed);
+    priority.failed = calloc(n_targets, sizeof *priority.failed);
+    priority.newest = calloc(n_targets, sizeof *priority.newest);
+    file_states_init();
+
+    if (config.locality)
+    {
+        priority.signature = malloc(n_targets * sizeof *priority.signature);
+
+        if (n_targets && !priority.signature)
+            FATAL_ERROR("Could not allocate target signatures");
+    }
+
+    if (n_targets && (!visited.state || !visited.updated || !priority.computed
+                      || !priority.failed || !priority.newest))
+        FATAL_ERROR("Could not allocate target states");
+
+    build_log_load();
+    status_init(roots, n_roots);
+    metrics.build_start_us = now_us();
+
+    /* Only successful builds leave a fingerprint behind. */
+    if (!config.simulate)
+    {
+        remove(FINGERPRINT_FILE_NAME);
+        fingerprint_snapshot(m->path);
+    }
+
+    /* All roots share a single traversal, so common
+     * dependencies are only evaluated once. */
+    for (size_t i = 0; i < n_roots; i++)
+        ret |= execute_commands(roots[i], NULL);
+
+#ifdef _POSIX_VERSION
+    status_timer(false);
+#endif
+    status_clear();
+    metrics_save(true);
+
+    if (config.simulate)
+        simulation_summary();
+    else
+    {
+        build_log_save();
+        /* Default targets are not known before parsing. */
+        fingerprint_save(m->path, roots, n ? n_roots : 0);
+    }
+
+    if (config.stats)
+        print_stats();
+
+    if (config.memstats)
+        print_memstats(m);
+
+    return ret;
+}
+
+/* Reports an error to the caller of a library function
+ * which does not need to jump out of nested calls. */
+static int report_error(const char *const format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(error_message, sizeof error_message, format, ap);
+    va_end(ap);
+
+    return 1;
+}
+
+void xmk_configure(const struct xmk_options *const options)
+{
+    config = *options;
+
+    /* Extra verbose mode implies verbose mode. */
+    if (config.extra_verbose)
+        config.verbose = true;
+
+    log_init();
+}
+
+const char *xmk_error(void)
+{
+    return error_message;
+}
+
+xmk *xmk_load(const char *const path)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    /* Volatile, since it is read after longjmp(). */
+    xmk *const volatile m = calloc(1, sizeof *m);
+
+    if (!m)
+    {
+        report_error("Could not allocate manifest");
+        return NULL;
+    }
+    else if (setjmp(handler))
+    {
+        error_handler = prev;
+        xmk_free(m);
+        return NULL;
+    }
+
+    error_handler = &handler;
+    load(m, path);
+    error_handler = prev;
+
+    return m;
+}
+
+void xmk_free(xmk *const m)
+{
+    if (m)
+    {
+        parser_free(&m->parser);
+        graph_free(&m->graph);
+        free(m->index_buffer);
+        free(m->path);
+        free(m->roots);
+        free(m);
+    }
+}
+
+int xmk_preprocess(const char *const path, FILE *const out)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    struct parser *const p = malloc(sizeof *p);
+    volatile int ret = 1;
+
+    if (!p)
+        return report_error("Could not allocate parser");
+
+    parser_init(p);
+
+    if (!setjmp(handler))
+    {
+        error_handler = &handler;
+        read_file(p, path);
+        preprocess(p, out);
+        ret = 0;
+    }
+
+    error_handler = prev;
+    parser_free(p);
+    free(p);
+
+    return ret;
+}
+
+bool xmk_up_to_date(const char *const path, const char *const *const targets, const size_t n)
+{
+    if (fingerprint_matches(path, targets, n))
+    {
+        LOGV("Fingerprint matches, nothing to be done");
+        metrics.build_start_us = now_us();
+        metrics_save(true);
+        memset(&metrics, 0, sizeof metrics);
+        return true;
+    }
+
+    return false;
+}
+
+size_t xmk_default_targets(const xmk *const m, const char *const **const targets)
+{
+    *targets = (const char *const *)m->parser.build_targets.names;
+
+    return m->parser.build_targets.n;
+}
+
+int xmk_deps(const xmk *const m, const char *const target,
+            const xmk_name_callback callback, void *const user)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    volatile int ret = 1;
+
+    if (!setjmp(handler))
+    {
+        size_t target_idx;
+
+        error_handler = &handler;
+
+        /* Names given by the user might not be normalized. */
+        if (!m->parser.symbols[TARGET].list_size
+            || !find_path(&m->parser.target_table,
+                        (const char *const *)*m->parser.symbols[TARGET].list,
+                        target, &target_idx))
+            FATAL_ERROR("Target \"%s\" could not be found on target list", target);
+
+        for (size_t i = 0; i < m->parser.symbols[DEPENDS_ON].list_size[target_idx]; i++)
+            callback(m->parser.symbols[DEPENDS_ON].list[target_idx][i], user);
+
+        ret = 0;
+    }
+
+    error_handler = prev;
+
+    return ret;
+}
+
+int xmk_rdeps(const xmk *const m, const char *const name,
+            const xmk_name_callback callback, void *const user)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    volatile int ret = 1;
+
+    if (!setjmp(handler))
+    {
+        const struct graph *const g = &m->graph;
+        size_t node;
+
+        error_handler = &handler;
+
+        if (!find_path(&g->table, g->names, name, &node))
+            FATAL_ERROR("%s is not part of the dependency graph", name);
+
+        for (size_t e = g->rdep_start[node]; e < g->rdep_start[node + 1]; e++)
+            callback(g->names[g->rdeps[e]], user);
+
+        ret = 0;
+    }
+
+    error_handler = prev;
+
+    return ret;
+}
+
+int xmk_affected(const xmk *const m, const char *const *const files, const size_t n,
+                const xmk_name_callback callback, void *const user)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    int ret = 1;
+
+    if (!setjmp(handler))
+    {
+        error_handler = &handler;
+        affected_targets(&m->graph, files, n, callback, user);
+
+        if (config.memstats)
+            print_memstats(m);
+
+        ret = 0;
+    }
+
+    error_handler = prev;
+
+    return ret;
+}
+
+int xmk_affected_path(const char *const path, const char *const *const files, const size_t n,
+                    const xmk_name_callback callback, void *const user)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    /* Volatile, since it is read after longjmp(). */
+    xmk *const volatile m = calloc(1, sizeof *m);
+    volatile int ret = 1;
+
+    if (!m)
+        return report_error("Could not allocate manifest");
+    else if (!setjmp(handler))
+    {
+        error_handler = &handler;
+
+        if (!graph_index_load(m, path))
+        {
+            graph_free(&m->graph);
+            free(m->index_buffer);
+            m->index_buffer = NULL;
+            load(m, path);
+            graph_index_save(m);
+        }
+
+        affected_targets(&m->graph, files, n, callback, user);
+        ret = 0;
+    }
+
+    error_handler = prev;
+    xmk_free(m);
+
+    return ret;
+}
+
+int xmk_dirty(xmk *const m, const char *const *const targets, const size_t n,
+                const xmk_name_callback callback, void *const user)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    volatile int ret = 1;
+
+    if (!setjmp(handler))
+    {
+        const size_t n_targets = m->parser.symbols[TARGET].list_size ?
+            *m->parser.symbols[TARGET].list_size : 0;
+        const char *const *roots;
+        size_t n_roots;
+
+        error_handler = &handler;
+        n_roots = resolve_roots(m, targets, n, &roots);
+        manifest = m;
+        file_states_init();
+        /* Same estimation used by the status line. */
+        status.plan = calloc(n_targets, sizeof *status.plan);
+
+        if (n_targets && !status.plan)
+            FATAL_ERROR("Could not allocate target states");
+
+        for (size_t i = 0; i < n_roots; i++)
+        {
+            size_t target_idx;
+
+            if (target_exists(&m->parser, roots[i], &target_idx))
+                status_plan(target_idx);
+            else
+                FATAL_ERROR("Target \"%s\" could not be found on target list", roots[i]);
+        }
+
+        for (size_t i = 0; i < n_targets; i++)
+        {
+            if (status.plan[i] == PLAN_DIRTY)
+                callback((*m->parser.symbols[TARGET].list)[i], user);
+        }
+
+        ret = 0;
+    }
+
+    error_handler = prev;
+    cleanup();
+
+    return ret;
+}
+
+int xmk_build(xmk *const m, const char *const *const targets, const size_t n,
+                const xmk_job_callback callback, void *const user)
+{
+    jmp_buf handler;
+    jmp_buf *const prev = error_handler;
+    volatile int ret = 1;
+
+    if (!setjmp(handler))
+    {
+        error_handler = &handler;
+        ret = build_roots(m, targets, n, callback, user);
+    }
+    else
+        /* Only builds draw the status line, so errors from manifests
+         * loaded on other threads never clear it. */
+        status_clear();
+
+    error_handler = prev;
+    cleanup();
+
+    return ret;
+}
@@ -0,0 +1,129 @@
+/*
+* libxmk, xmk build engine as a library
+*
+* 2019 - 2020 Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public LIcense as publised by
+* the Free Software Foundation; either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+* MA 02110-1301, USA.
+*/
+
+#ifndef XMK_H
+#define XMK_H
+
+/* Build with:
+ *      cc -std=c99 -c libxmk.c && ar rcs libxmk.a libxmk.o
+ * or, as a shared library:
+ *      cc -std=c99 -fPIC -shared -o libxmk.so libxmk.c
+ *
+ * Functions returning int return 0 on success. On failure,
+ * a description is available from xmk_error().
+ *
+ * Manifests are independent from each other, so several
+ * of them can be loaded and queried from different threads.
+ * Only one build can run at a time in a process, though. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Parsed manifest and its dependency graph. */
+typedef struct xmk xmk;
+
+/* Receives a target or file name, owned by the manifest. */
+typedef void (*xmk_name_callback)(const char *name, void *user);
+
+/* Called once all commands for a target have been
+ * executed, or as soon as one of them fails. */
+typedef void (*xmk_job_callback)(const char *target, int exit_code, void *user);
+
+struct xmk_options
+{
+    bool verbose;
+    bool extra_verbose;
+    /* Commands are not printed into stdout. */
+    bool quiet;
+    /* Commands are not executed, but simulated in virtual time. */
+    bool simulate;
+    /* Job statistics are printed after building. */
+    bool stats;
+    /* Memory used by each structure is printed after
+     * building or querying affected targets. */
+    bool memstats;
+    /* Disables the progress status line shown on terminals. */
+    bool no_status;
+    /* Targets sharing most dependencies are built one after another. */
+    bool locality;
+    /* Prometheus text file written after building, or NULL. */
+    const char *metrics_path;
+};
+
+/* Options apply to all following calls. All of them are disabled by default. */
+void xmk_configure(const struct xmk_options *options);
+
+/* Describes the last error that happened on the calling thread. */
+const char *xmk_error(void);
+
+/* Returns NULL on error. */
+xmk *xmk_load(const char *path);
+void xmk_free(xmk *m);
+
+/* Writes the input file with all defines expanded. Only define
+ * statements are parsed, so no other errors are reported. */
+int xmk_preprocess(const char *path, FILE *out);
+
+/* Returns whether nothing changed since the last successful build
+ * of the given targets, so not even loading the manifest is needed.
+ * Metrics for the empty build are written, if enabled. */
+bool xmk_up_to_date(const char *path, const char *const *targets, size_t n);
+
+/* Targets from "build" statements. */
+size_t xmk_default_targets(const xmk *m, const char *const **targets);
+
+/* Direct dependencies of a target, in declaration order. */
+int xmk_deps(const xmk *m, const char *target, xmk_name_callback callback, void *user);
+
+/* Targets depending directly on a target or file. */
+int xmk_rdeps(const xmk *m, const char *name, xmk_name_callback callback, void *user);
+
+/* Targets that would be rebuilt if any of the files changed, in build order. */
+int xmk_affected(const xmk *m, const char *const *files, size_t n,
+                xmk_name_callback callback, void *user);
+
+/* Same as xmk_affected(), for a manifest not loaded yet. Its graph is
+ * saved, so later queries do not parse it again until it changes. */
+int xmk_affected_path(const char *path, const char *const *files, size_t n,
+                    xmk_name_callback callback, void *user);
+
+/* Targets that must be built so the given ones are up to date, in
+ * manifest order. When no targets are given, those from "build"
+ * statements are used. */
+int xmk_dirty(xmk *m, const char *const *targets, size_t n,
+                xmk_name_callback callback, void *user);
+
+/* Builds the given targets, or those from "build" statements if none
+ * are given. callback might be NULL. Returns non-zero on failure. */
+int xmk_build(xmk *m, const char *const *targets, size_t n,
+                xmk_job_callback callback, void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* XMK_H */
@@ -0,0 +1,392 @@
+/*
+* xmk_bench, microbenchmarks for xmk hot parse paths
+*
+* 2019 - 2020 Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public LIcense as publised by
+* the Free Software Foundation; either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+* MA 02110-1301, USA.
+*/
+
+/* Build with:
+ *      cc -std=c99 -O2 -o xmk_bench xmk_bench.c
+ *
+ * libxmk.c is included directly so its static functions
+ * can be called without going through its API. Memory
+ * allocation functions are replaced by counting wrappers
+ * so bytes allocated per operation can be reported. A
+ * realloc only counts the bytes a block grows by. */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct
+{
+    size_t bytes;
+    size_t allocs;
+} alloc_stats;
+
+/* Placed before each block, so realloc can only count the
+ * bytes a block grows by instead of its whole new size. */
+union alloc_header
+{
+    size_t size;
+    long double align_ld;
+    long long align_ll;
+    void *align_p;
+};
+
+static void *alloc_init(union alloc_header *const h, const size_t sz)
+{
+    if (!h)
+        return NULL;
+
+    h->size = sz;
+    return h + 1;
+}
+
+static void *bench_malloc(const size_t sz)
+{
+    alloc_stats.bytes += sz;
+    alloc_stats.allocs++;
+    return alloc_init(malloc(sizeof (union alloc_header) + sz), sz);
+}
+
+static void *bench_calloc(const size_t n, const size_t sz)
+{
+    alloc_stats.bytes += n * sz;
+    alloc_stats.allocs++;
+    return alloc_init(calloc(1, sizeof (union alloc_header) + n * sz), n * sz);
+}
+
+static void *bench_realloc(void *const p, const size_t sz)
+{
+    union alloc_header *const h = p ? (union alloc_header *)p - 1 : NULL;
+    const size_t old = h ? h->size : 0;
+
+    if (sz > old)
+        alloc_stats.bytes += sz - old;
+
+    alloc_stats.allocs++;
+    return alloc_init(realloc(h, sizeof *h + sz), sz);
+}
+
+static void bench_free(void *const p)
+{
+    if (p)
+        free((union alloc_header *)p - 1);
+}
+
+#define malloc(sz) bench_malloc(sz)
+#define calloc(n, sz) bench_calloc(n, sz)
+#define realloc(p, sz) bench_realloc(p, sz)
+#define free(p) bench_free(p)
+#include "libxmk.c"
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+struct measure
+{
+    struct timespec start;
+    size_t bytes;
+    size_t allocs;
+};
+
+static void measure_start(struct measure *const m)
+{
+    m->bytes = alloc_stats.bytes;
+    m->allocs = alloc_stats.allocs;
+    clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+static double elapsed_ns(const struct timespec *const start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void report(const char *const name, const struct measure *const m, const double ns, const size_t ops)
+{
+    const size_t bytes = alloc_stats.bytes - m->bytes;
+    const size_t allocs = alloc_stats.allocs - m->allocs;
+
+    printf("%-40s %12zu ops %12.1f ns/op %12.1f B/op %8.2f allocs/op\n",
+            name, ops, ns / ops, (double)bytes / ops, (double)allocs / ops);
+}
+
+/* Parser context shared by all benchmarks. */
+static struct parser parser;
+
+/* Return parser state to its initial values so
+ * benchmarks do not influence each other. */
+static void bench_reset(void)
+{
+    parser_free(&parser);
+}
+
+static void add_defines(const size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        char str[32];
+
+        sprintf(str, "DEFINE_%zu", i);
+        add_define(&parser, str);
+        sprintf(str, "value_%zu", i);
+        add_define(&parser, str);
+    }
+}
+
+static void bench_get_word(void)
+{
+    static const char *const samples[] =
+    {
+        "target out/obj/file.o {\n"
+        "\tdepends on {\n"
+        "\t\tsrc/file.c\n"
+        "\t\tinclude/file.h\n"
+        "\t}\n\n"
+        "\tcreated using {\n"
+        "\t\tgcc -c src/file.c -o out/obj/file.o -Wall -O2\n"
+        "\t}\n"
+        "}\n",
+
+        "# Comments are skipped by the lexer.\n"
+        "define CC_INS as \"gcc -c -O2 -Wall -Wextra -pedantic\"\n"
+        "# Another comment line.\n"
+        "define LD_INS as \"gcc -o\"\n"
+    };
+    enum {COPIES = 1000, ROUNDS = 20};
+
+    foreach (const char *const, sample, samples)
+    {
+        const size_t len = strlen(*sample);
+        char *const buf = malloc(len * COPIES + 1);
+
+        if (!buf)
+            return;
+
+        for (size_t i = 0; i < COPIES; i++)
+            memcpy(&buf[i * len], *sample, len);
+
+        buf[len * COPIES] = '\0';
+
+        {
+            struct measure m;
+            size_t ops = 0;
+
+            measure_start(&m);
+
+            for (size_t r = 0; r < ROUNDS; r++)
+            {
+                size_t from = 0;
+                bool newline_detected;
+
+                while (get_word(&parser, buf, &from, &newline_detected))
+                    ops++;
+            }
+
+            report(sample == samples ? "get_word/target_block" : "get_word/comments_defines",
+                    &m, elapsed_ns(&m.start), ops);
+        }
+
+        free(buf);
+    }
+}
+
+static void bench_define_refs(void)
+{
+    static const char line[] = "target out/obj/file.o { created using { $CC_INS src/file.c } }\n";
+    static const size_t buf_sizes[] = {1024, 64 * 1024, 1024 * 1024};
+
+    foreach (const size_t, bs, buf_sizes)
+    {
+        const size_t copies = *bs / (sizeof line - 1);
+        char *const buf = malloc(copies * (sizeof line - 1) + 1);
+        char label[64];
+        struct measure m;
+        size_t from = 0, ops = 0;
+        bool newline_detected;
+
+        if (!buf)
+            return;
+
+        for (size_t i = 0; i < copies; i++)
+            memcpy(&buf[i * (sizeof line - 1)], line, sizeof line - 1);
+
+        buf[copies * (sizeof line - 1)] = '\0';
+        add_define(&parser, "CC");
+        add_define(&parser, "gcc");
+        add_define(&parser, "CC_FLAGS");
+        add_define(&parser, "-O2 -Wall");
+        add_define(&parser, "CC_INS");
+        add_define(&parser, "$CC $CC_FLAGS -c");
+        measure_start(&m);
+
+        /* Time per word must not depend on buffer size. */
+        while (get_word(&parser, buf, &from, &newline_detected))
+            ops++;
+
+        sprintf(label, "get_word/define_refs/size=%zu", *bs);
+        report(label, &m, elapsed_ns(&m.start), ops);
+        free(buf);
+        bench_reset();
+    }
+}
+
+static void bench_is_define(void)
+{
+    static const size_t n_defines[] = {1, 16, 256, 4096};
+    enum {ITERATIONS = 100000};
+
+    foreach (const size_t, nd, n_defines)
+    {
+        char last[32], label[64];
+        struct measure m;
+
+        add_defines(*nd);
+        sprintf(last, "DEFINE_%zu", *nd - 1);
+
+        measure_start(&m);
+
+        for (size_t i = 0; i < ITERATIONS; i++)
+            is_define(&parser, last);
+
+        sprintf(label, "is_define/hit_last/defines=%zu", *nd);
+        report(label, &m, elapsed_ns(&m.start), ITERATIONS);
+
+        measure_start(&m);
+
+        for (size_t i = 0; i < ITERATIONS; i++)
+            is_define(&parser, "UNDEFINED");
+
+        sprintf(label, "is_define/miss/defines=%zu", *nd);
+        report(label, &m, elapsed_ns(&m.start), ITERATIONS);
+        bench_reset();
+    }
+}
+
+static void bench_target_exists(void)
+{
+    static const size_t n_targets[] = {1, 16, 256, 4096};
+    enum {ITERATIONS = 100000};
+
+    foreach (const size_t, nt, n_targets)
+    {
+        char last[64], label[64];
+        struct measure m;
+
+        for (size_t i = 0; i < *nt; i++)
+        {
+            sprintf(last, "out/obj/file_%zu.o", i);
+            add_target(&parser, last);
+        }
+
+        measure_start(&m);
+
+        for (size_t i = 0; i < ITERATIONS; i++)
+        {
+            size_t idx;
+
+            target_exists(&parser, last, &idx);
+        }
+
+        sprintf(label, "target_exists/hit_last/targets=%zu", *nt);
+        report(label, &m, elapsed_ns(&m.start), ITERATIONS);
+        bench_reset();
+    }
+}
+
+static void bench_handle_list(void)
+{
+    static const char *const words[] =
+    {
+        "gcc", "-c", "src/file.c", "-o", "out/obj/file.o", "-Wall", "-O2"
+    };
+    enum {ITERATIONS = 20000};
+    const syntax_rule *const rule = &syntax_rules[CREATED_USING];
+    struct measure m;
+
+    add_target(&parser, "out/obj/file.o");
+    target_scope_block_opened(&parser);
+    measure_start(&m);
+
+    for (size_t i = 0; i < ITERATIONS; i++)
+    {
+        foreach (const char *const, word, words)
+        {
+            enum parse_state state = CHECKING;
+            bool finished;
+
+            /* Each command starts on a new line. */
+            handle_list(&parser, rule, *word, &state, word == words, &finished);
+        }
+    }
+
+    report("handle_list/command_7_words", &m, elapsed_ns(&m.start), ITERATIONS);
+    bench_reset();
+}
+
+static void bench_path_functions(void)
+{
+    static const char *const words[] =
+    {
+        "$(basename src/dir.d/file.c)",
+        "$(ext src/dir.d/file.c)",
+        "$(dir src/dir.d/file.c)",
+        "$(notdir src/dir.d/file.c)",
+        "$(patsubst %.c,out/obj/%.o,$(notdir src/dir.d/file.c))"
+    };
+    enum {ITERATIONS = 100000};
+
+    foreach (const char *const, word, words)
+    {
+        char label[96];
+        struct measure m;
+
+        /* Results are computed on the first call only. */
+        eval_function(&parser, *word);
+        measure_start(&m);
+
+        for (size_t i = 0; i < ITERATIONS; i++)
+            eval_function(&parser, *word);
+
+        sprintf(label, "eval_function/%.*s", (int)strcspn(*word + 2, " "), *word + 2);
+        report(label, &m, elapsed_ns(&m.start), ITERATIONS);
+    }
+
+    bench_reset();
+}
+
+int main(void)
+{
+    parser_init(&parser);
+    bench_get_word();
+    bench_define_refs();
+    bench_is_define();
+    bench_target_exists();
+    bench_handle_list();
+    bench_path_functions();
+
+    return 0;
+}